@@ -2,12 +2,16 @@
 #define AFFINE_INVARIANT_FEATURES_AFFINE_INVARIANT_FEATURE
 
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include <affine_invariant_features/affine_invariant_feature_base.hpp>
+#include <affine_invariant_features/numa_affinity.hpp>
 #include <affine_invariant_features/parallel_tasks.hpp>
+#include <affine_invariant_features/sampling_grid.hpp>
 
 #include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/ref.hpp>
 
 #include <opencv2/core.hpp>
@@ -17,97 +21,91 @@
 namespace affine_invariant_features {
 
 //
-// AffineInvariantFeature that samples features in various affine transformation space
+// AffineInvariantFeatureT that samples features in the affine transformation space given by Grid.
+// The grid is a compile-time table (see sampling_grid.hpp), and simulation tasks are
+// specialized on whether the simulation is identity and whether the detector and extractor
+// are the same instance when the tasks are bound, not in the tasks.
 //
 
-class AffineInvariantFeature : public AffineInvariantFeatureBase {
+template < class Detector, class Extractor, class Grid >
+class AffineInvariantFeatureT : public AffineInvariantFeatureBaseT< Detector, Extractor > {
 protected:
-  // the private constructor. users must use create() to instantiate an AffineInvariantFeature
-  AffineInvariantFeature(const cv::Ptr< cv::Feature2D > detector,
-                         const cv::Ptr< cv::Feature2D > extractor, const double nstripes)
-      : AffineInvariantFeatureBase(detector, extractor), nstripes_(nstripes) {
-    // generate parameters for affine invariant sampling
-    phi_params_.push_back(0.);
-    tilt_params_.push_back(1.);
-    for (int i = 1; i < 6; ++i) {
-      const double tilt(std::pow(2., 0.5 * i));
-      for (double phi = 0.; phi < 180.; phi += 72. / tilt) {
-        phi_params_.push_back(phi);
-        tilt_params_.push_back(tilt);
-      }
-    }
-    ntasks_ = phi_params_.size();
-  }
+  typedef AffineInvariantFeatureBaseT< Detector, Extractor > Base;
+
+  // the private constructor. users must use create() to instantiate an AffineInvariantFeatureT
+  AffineInvariantFeatureT(const cv::Ptr< Detector > detector, const cv::Ptr< Extractor > extractor,
+                          const double nstripes)
+      : Base(detector, extractor), nstripes_(nstripes), numa_aware_(false), memory_budget_(0),
+        backend_bytes_per_pixel_(256.), peak_memory_usage_(0) {}
 
 public:
-  virtual ~AffineInvariantFeature() {}
+  virtual ~AffineInvariantFeatureT() {}
 
   //
-  // unique interfaces to instantiate an AffineInvariantFeature
+  // unique interfaces to instantiate an AffineInvariantFeatureT
   //
 
-  static cv::Ptr< AffineInvariantFeature > create(const cv::Ptr< cv::Feature2D > feature,
-                                                  const double nstripes = -1.) {
-    return new AffineInvariantFeature(feature, feature, nstripes);
+  static cv::Ptr< AffineInvariantFeatureT > create(const cv::Ptr< Detector > feature,
+                                                   const double nstripes = -1.) {
+    return new AffineInvariantFeatureT(feature, feature, nstripes);
   }
 
-  static cv::Ptr< AffineInvariantFeature > create(const cv::Ptr< cv::Feature2D > detector,
-                                                  const cv::Ptr< cv::Feature2D > extractor,
-                                                  const double nstripes = -1.) {
-    return new AffineInvariantFeature(detector, extractor, nstripes);
+  static cv::Ptr< AffineInvariantFeatureT > create(const cv::Ptr< Detector > detector,
+                                                   const cv::Ptr< Extractor > extractor,
+                                                   const double nstripes = -1.) {
+    return new AffineInvariantFeatureT(detector, extractor, nstripes);
   }
 
   //
-  // overloaded functions from AffineInvariantFeatureBase or its base class
+  // overloaded functions from AffineInvariantFeatureBaseT or its base class
   //
 
   virtual void compute(cv::InputArray image, std::vector< cv::KeyPoint > &keypoints,
                        cv::OutputArray descriptors) {
-    // extract the input
-    const cv::Mat image_mat(image.getMat());
+    // extract inputs
+    const cv::Mat image_mat(toGray(image.getMat()));
+    const std::vector< cv::KeyPoint > src_keypoints(keypoints);
 
     // prepare outputs of following parallel processing
-    std::vector< std::vector< cv::KeyPoint > > keypoints_array(ntasks_, keypoints);
-    std::vector< cv::Mat > descriptors_array(ntasks_);
-
-    // bind each parallel task and arguments
-    ParallelTasks tasks(ntasks_);
-    for (std::size_t i = 0; i < ntasks_; ++i) {
-      tasks[i] = boost::bind(&AffineInvariantFeature::computeTask, this, boost::ref(image_mat),
-                             boost::ref(keypoints_array[i]), boost::ref(descriptors_array[i]),
-                             phi_params_[i], tilt_params_[i]);
+    std::vector< std::vector< cv::KeyPoint > > keypoints_array(Grid::SIZE);
+    std::vector< cv::Mat > descriptors_array(Grid::SIZE);
+
+    // bind each parallel task and arguments except the source image and mask
+    std::vector< SourceTask > tasks(Grid::SIZE);
+    for (std::size_t i = 0; i < Grid::SIZE; ++i) {
+      tasks[i] = boost::bind(Grid::isIdentity(i) ? &AffineInvariantFeatureT::computeTask< true >
+                                                 : &AffineInvariantFeatureT::computeTask< false >,
+                             this, _1, boost::cref(src_keypoints), boost::ref(keypoints_array[i]),
+                             boost::ref(descriptors_array[i]), Grid::phi(i), Grid::tilt(i));
     }
 
-    // do parallel tasks
-    cv::parallel_for_(cv::Range(0, ntasks_), tasks, nstripes_);
-
-    // fill the final outputs
-    extendKeypoints(keypoints_array, keypoints);
-    extendDescriptors(descriptors_array, descriptors);
+    // do parallel tasks and fill the final outputs
+    cv::Mat descriptors_mat;
+    runBatches(tasks, image_mat, cv::Mat(), keypoints_array, &descriptors_array, keypoints,
+               &descriptors_mat);
+    setOutput(descriptors_mat, descriptors);
   }
 
   virtual void detect(cv::InputArray image, std::vector< cv::KeyPoint > &keypoints,
                       cv::InputArray mask = cv::noArray()) {
     // extract inputs
-    const cv::Mat image_mat(image.getMat());
+    const cv::Mat image_mat(toGray(image.getMat()));
     const cv::Mat mask_mat(mask.getMat());
 
     // prepare an output of following parallel processing
-    std::vector< std::vector< cv::KeyPoint > > keypoints_array(ntasks_);
-
-    // bind each parallel task and arguments
-    ParallelTasks tasks(ntasks_);
-    for (std::size_t i = 0; i < ntasks_; ++i) {
-      tasks[i] = boost::bind(&AffineInvariantFeature::detectTask, this, boost::ref(image_mat),
-                             boost::ref(mask_mat), boost::ref(keypoints_array[i]), phi_params_[i],
-                             tilt_params_[i]);
+    std::vector< std::vector< cv::KeyPoint > > keypoints_array(Grid::SIZE);
+
+    // bind each parallel task and arguments except the source image and mask
+    std::vector< SourceTask > tasks(Grid::SIZE);
+    for (std::size_t i = 0; i < Grid::SIZE; ++i) {
+      tasks[i] = boost::bind(Grid::isIdentity(i) ? &AffineInvariantFeatureT::detectTask< true >
+                                                 : &AffineInvariantFeatureT::detectTask< false >,
+                             this, _1, _2, boost::ref(keypoints_array[i]), Grid::phi(i),
+                             Grid::tilt(i));
     }
 
-    // do parallel tasks
-    cv::parallel_for_(cv::Range(0, ntasks_), tasks, nstripes_);
-
-    // fill the final output
-    extendKeypoints(keypoints_array, keypoints);
+    // do parallel tasks and fill the final output
+    runBatches(tasks, image_mat, mask_mat, keypoints_array, NULL, keypoints, NULL);
   }
 
   virtual void detectAndCompute(cv::InputArray image, cv::InputArray mask,
@@ -120,35 +118,324 @@ public:
     }
 
     // extract inputs
-    const cv::Mat image_mat(image.getMat());
+    const cv::Mat image_mat(toGray(image.getMat()));
     const cv::Mat mask_mat(mask.getMat());
 
     // prepare outputs of following parallel processing
-    std::vector< std::vector< cv::KeyPoint > > keypoints_array(ntasks_);
-    std::vector< cv::Mat > descriptors_array(ntasks_);
-
-    // bind each parallel task and arguments
-    ParallelTasks tasks(ntasks_);
-    for (std::size_t i = 0; i < ntasks_; ++i) {
-      tasks[i] =
-          boost::bind(&AffineInvariantFeature::detectAndComputeTask, this, boost::ref(image_mat),
-                      boost::ref(mask_mat), boost::ref(keypoints_array[i]),
-                      boost::ref(descriptors_array[i]), phi_params_[i], tilt_params_[i]);
+    std::vector< std::vector< cv::KeyPoint > > keypoints_array(Grid::SIZE);
+    std::vector< cv::Mat > descriptors_array(Grid::SIZE);
+
+    // bind each parallel task and arguments except the source image and mask
+    const bool shared(this->sharesBackend());
+    std::vector< SourceTask > tasks(Grid::SIZE);
+    for (std::size_t i = 0; i < Grid::SIZE; ++i) {
+      DetectAndComputeTask task;
+      if (Grid::isIdentity(i)) {
+        task = shared ? &AffineInvariantFeatureT::detectAndComputeTask< true, true >
+                      : &AffineInvariantFeatureT::detectAndComputeTask< true, false >;
+      } else {
+        task = shared ? &AffineInvariantFeatureT::detectAndComputeTask< false, true >
+                      : &AffineInvariantFeatureT::detectAndComputeTask< false, false >;
+      }
+      tasks[i] = boost::bind(task, this, _1, _2, boost::ref(keypoints_array[i]),
+                             boost::ref(descriptors_array[i]), Grid::phi(i), Grid::tilt(i));
     }
 
-    // do parallel tasks
-    cv::parallel_for_(cv::Range(0, ntasks_), tasks, nstripes_);
+    // do parallel tasks and fill the final outputs
+    cv::Mat descriptors_mat;
+    runBatches(tasks, image_mat, mask_mat, keypoints_array, &descriptors_array, keypoints,
+               &descriptors_mat);
+    setOutput(descriptors_mat, descriptors);
+  }
 
-    // fill the final outputs
-    extendKeypoints(keypoints_array, keypoints);
-    extendDescriptors(descriptors_array, descriptors);
+  //
+  // incremental extraction
+  //
+
+  // update keypoints and descriptors given by detectAndCompute() with old_mask
+  // to ones with new_mask (an empty mask means the whole image).
+  // only the region where the masks differ, dilated by the band, is re-extracted.
+  // each simulation works on a crop around the region with a margin of the band
+  // scaled by the tilt, and then previous keypoints out of the region are merged.
+  // the result is close to a full re-extraction for backends which filter keypoints by the mask
+  // (e.g. SIFT, SURF, AKAZE) as long as the band covers their support, and is approximate
+  // for ones which retain a limited number of keypoints per image (e.g. ORB).
+  void updateAndCompute(cv::InputArray image, cv::InputArray old_mask, cv::InputArray new_mask,
+                        std::vector< cv::KeyPoint > &keypoints, cv::InputOutputArray descriptors,
+                        const int band = 32) {
+    // extract inputs
+    const cv::Mat image_mat(toGray(image.getMat()));
+    const cv::Mat old_mask_mat(toBinaryMask(old_mask.getMat(), image_mat.size()));
+    const cv::Mat new_mask_mat(toBinaryMask(new_mask.getMat(), image_mat.size()));
+    const cv::Mat src_descriptors(descriptors.getMat());
+    CV_Assert(src_descriptors.rows == static_cast< int >(keypoints.size()));
+    CV_Assert(band >= 0);
+
+    // the region to be re-extracted
+    cv::Mat dirty;
+    cv::bitwise_xor(old_mask_mat, new_mask_mat, dirty);
+    std::vector< cv::Point > dirty_points;
+    cv::findNonZero(dirty, dirty_points);
+    if (dirty_points.empty()) {
+      return;
+    }
+    cv::dilate(dirty, dirty,
+               cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * band + 1, 2 * band + 1)));
+    cv::Rect bounds(cv::boundingRect(dirty_points));
+    bounds = cv::Rect(bounds.x - band, bounds.y - band, bounds.width + 2 * band,
+                      bounds.height + 2 * band) &
+             cv::Rect(0, 0, image_mat.cols, image_mat.rows);
+    UpdateRegion region;
+    region.image = image_mat;
+    cv::bitwise_and(new_mask_mat, dirty, region.mask);
+    region.dirty = dirty;
+    region.bounds = bounds;
+    region.band = band;
+
+    // prepare outputs of following parallel processing
+    std::vector< std::vector< cv::KeyPoint > > keypoints_array(Grid::SIZE);
+    std::vector< cv::Mat > descriptors_array(Grid::SIZE);
+
+    // re-extract in the region
+    const bool shared(this->sharesBackend());
+    ParallelTasks tasks(Grid::SIZE);
+    for (std::size_t i = 0; i < Grid::SIZE; ++i) {
+      DetectAndComputeTask task;
+      if (Grid::isIdentity(i)) {
+        task = shared ? &AffineInvariantFeatureT::detectAndComputeTask< true, true >
+                      : &AffineInvariantFeatureT::detectAndComputeTask< true, false >;
+      } else {
+        task = shared ? &AffineInvariantFeatureT::detectAndComputeTask< false, true >
+                      : &AffineInvariantFeatureT::detectAndComputeTask< false, false >;
+      }
+      tasks[i] = boost::bind(&AffineInvariantFeatureT::updateTask, this, task, boost::cref(region),
+                             boost::ref(keypoints_array[i]), boost::ref(descriptors_array[i]),
+                             Grid::phi(i), Grid::tilt(i));
+    }
+    cv::parallel_for_(cv::Range(0, tasks.size()), tasks, nstripes_);
+
+    // keep previous keypoints out of the region
+    std::vector< cv::KeyPoint > merged_keypoints;
+    std::vector< int > kept_rows;
+    for (std::size_t i = 0; i < keypoints.size(); ++i) {
+      if (!isOnMask(dirty, keypoints[i].pt)) {
+        merged_keypoints.push_back(keypoints[i]);
+        kept_rows.push_back(i);
+      }
+    }
+    cv::Mat merged_descriptors(kept_rows.size(), this->descriptorSize(), this->descriptorType());
+    for (std::size_t i = 0; i < kept_rows.size(); ++i) {
+      src_descriptors.row(kept_rows[i]).copyTo(merged_descriptors.row(i));
+    }
+
+    // append re-extracted keypoints
+    std::vector< std::size_t > all(Grid::SIZE);
+    for (std::size_t i = 0; i < Grid::SIZE; ++i) {
+      merged_keypoints.insert(merged_keypoints.end(), keypoints_array[i].begin(),
+                              keypoints_array[i].end());
+      all[i] = i;
+    }
+    appendDescriptors(descriptors_array, all, merged_descriptors);
+
+    keypoints.swap(merged_keypoints);
+    setOutput(merged_descriptors, descriptors);
   }
 
+  //
+  // execution options
+  //
+
+  // if enabled, simulations are distributed over NUMA nodes in round robin.
+  // a thread running a simulation is pinned to CPUs of the assigned node
+  // and reads a replica of the source image allocated on the node.
+  void setNumaAware(const bool numa_aware) { numa_aware_ = numa_aware; }
+
+  bool getNumaAware() const { return numa_aware_; }
+
+  // if > 0, simulations are run in batches whose estimated memory footprint fits the budget
+  // together with the outputs accumulated so far, and keypoints and descriptors of each batch
+  // are moved into the final outputs before the next batch.
+  // a batch has one simulation at least even if it exceeds the budget.
+  void setMemoryBudget(const std::size_t bytes) { memory_budget_ = bytes; }
+
+  std::size_t getMemoryBudget() const { return memory_budget_; }
+
+  // working memory of the backends per pixel of a simulated image, used to estimate footprints.
+  // the default is a rough value for scale space detectors like SIFT.
+  void setBackendBytesPerPixel(const double bytes) { backend_bytes_per_pixel_ = bytes; }
+
+  double getBackendBytesPerPixel() const { return backend_bytes_per_pixel_; }
+
+  // estimated peak memory usage of the last call of detect(), compute() or detectAndCompute()
+  std::size_t getPeakMemoryUsage() const { return peak_memory_usage_; }
+
   virtual cv::String getDefaultName() const { return "AffineInvariantFeature"; }
 
 protected:
-  void computeTask(const cv::Mat &src_image, std::vector< cv::KeyPoint > &keypoints,
-                   cv::Mat &descriptors, const double phi, const double tilt) const {
+  // a task which processes the given source image and mask
+  typedef boost::function< void(const cv::Mat &, const cv::Mat &) > SourceTask;
+
+  void runTasks(const std::vector< SourceTask > &src_tasks, const cv::Mat &image,
+                const cv::Mat &mask) const {
+    const int nnodes(numa_aware_ ? NumaTopology::numNodes() : 1);
+    NodeReplicas replicas(image, mask, nnodes);
+
+    ParallelTasks tasks(src_tasks.size());
+    for (std::size_t i = 0; i < src_tasks.size(); ++i) {
+      if (nnodes > 1) {
+        tasks[i] = boost::bind(&AffineInvariantFeatureT::runOnNode, boost::ref(replicas),
+                               i % nnodes, boost::cref(src_tasks[i]));
+      } else {
+        tasks[i] = boost::bind(src_tasks[i], boost::cref(image), boost::cref(mask));
+      }
+    }
+
+    cv::parallel_for_(cv::Range(0, tasks.size()), tasks, nstripes_);
+  }
+
+  // run tasks in batches fitting the memory budget together with the outputs so far,
+  // and move keypoints and descriptors of each batch into the final outputs.
+  // the descriptor output doubles its capacity when a batch does not fit,
+  // so that the outputs are reallocated only logarithmically many times.
+  void runBatches(const std::vector< SourceTask > &tasks, const cv::Mat &image, const cv::Mat &mask,
+                  std::vector< std::vector< cv::KeyPoint > > &keypoints_array,
+                  std::vector< cv::Mat > *descriptors_array, std::vector< cv::KeyPoint > &keypoints,
+                  cv::Mat *descriptors) {
+    keypoints.clear();
+    peak_memory_usage_ = 0;
+
+    std::vector< std::size_t > footprints(tasks.size());
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+      footprints[i] = estimateFootprint(image, i);
+    }
+
+    // the descriptor output whose first nrows rows are filled
+    cv::Mat buffer;
+    int nrows(0);
+
+    std::vector< SourceTask > batch_tasks;
+    std::vector< std::size_t > batch;
+    std::size_t batch_bytes(0), output_bytes(0);
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+      // add the task to the batch if it fits the budget with the outputs so far
+      batch_tasks.push_back(tasks[i]);
+      batch.push_back(i);
+      batch_bytes += footprints[i];
+      if (i + 1 < tasks.size() &&
+          (memory_budget_ == 0 ||
+           output_bytes + batch_bytes + footprints[i + 1] <= memory_budget_)) {
+        continue;
+      }
+
+      // run the batch
+      runTasks(batch_tasks, image, mask);
+
+      // move the keypoints
+      int batch_rows(0);
+      std::size_t batch_descriptor_bytes(0);
+      for (std::vector< std::size_t >::const_iterator j = batch.begin(); j != batch.end(); ++j) {
+        keypoints.insert(keypoints.end(), keypoints_array[*j].begin(), keypoints_array[*j].end());
+        std::vector< cv::KeyPoint >().swap(keypoints_array[*j]);
+        if (descriptors_array) {
+          const cv::Mat &d((*descriptors_array)[*j]);
+          batch_rows += d.rows;
+          batch_descriptor_bytes += d.total() * d.elemSize();
+        }
+      }
+
+      // the working memory and descriptors of the batch, and the outputs so far
+      const std::size_t keypoint_bytes(keypoints.capacity() * sizeof(cv::KeyPoint));
+      std::size_t buffer_bytes(buffer.total() * buffer.elemSize());
+      peak_memory_usage_ = std::max(peak_memory_usage_, batch_bytes + batch_descriptor_bytes +
+                                                            keypoint_bytes + buffer_bytes);
+
+      // move the descriptors, doubling the capacity of the output if they do not fit.
+      // the old and grown outputs coexist while the filled rows are copied.
+      if (descriptors_array && descriptors) {
+        if (nrows + batch_rows > buffer.rows) {
+          cv::Mat grown(std::max(2 * buffer.rows, nrows + batch_rows), this->descriptorSize(),
+                        this->descriptorType());
+          if (nrows > 0) {
+            buffer.rowRange(0, nrows).copyTo(grown.rowRange(0, nrows));
+          }
+          const std::size_t grown_bytes(grown.total() * grown.elemSize());
+          peak_memory_usage_ =
+              std::max(peak_memory_usage_,
+                       batch_descriptor_bytes + keypoint_bytes + buffer_bytes + grown_bytes);
+          buffer = grown;
+          buffer_bytes = grown_bytes;
+        }
+        for (std::vector< std::size_t >::const_iterator j = batch.begin(); j != batch.end(); ++j) {
+          cv::Mat &d((*descriptors_array)[*j]);
+          if (d.rows > 0) {
+            d.copyTo(buffer.rowRange(nrows, nrows + d.rows));
+            nrows += d.rows;
+          }
+          d.release();
+        }
+      }
+      output_bytes = keypoint_bytes + buffer_bytes;
+
+      batch_tasks.clear();
+      batch.clear();
+      batch_bytes = 0;
+    }
+
+    // the filled rows of the output (the spare capacity is released with the output)
+    if (descriptors_array && descriptors) {
+      *descriptors = buffer.empty()
+                         ? cv::Mat(0, this->descriptorSize(), this->descriptorType())
+                         : buffer.rowRange(0, nrows);
+    }
+  }
+
+  // estimated working memory of the i-th simulation on the image
+  std::size_t estimateFootprint(const cv::Mat &image, const std::size_t i) const {
+    const double area(image.total());
+    const double elem_size(image.elemSize());
+    if (Grid::isIdentity(i)) {
+      // the backend works on the source image
+      return area * backend_bytes_per_pixel_;
+    }
+
+    // the bounding box of the rotated image
+    const double rad(Grid::phi(i) * CV_PI / 180.);
+    const double c(std::abs(std::cos(rad))), s(std::abs(std::sin(rad)));
+    const double rotated_area((image.cols * c + image.rows * s) *
+                              (image.cols * s + image.rows * c));
+    const double tilted_area(rotated_area / Grid::tilt(i));
+
+    // the cloned image and mask, the rotated and blurred images and the rotated mask,
+    // and the tilted image with the working memory of the backend
+    return area * (elem_size + 1.) + rotated_area * (2. * elem_size + 1.) +
+           tilted_area * (elem_size + backend_bytes_per_pixel_);
+  }
+
+  static void runOnNode(NodeReplicas &replicas, const int node, const SourceTask &task) {
+    const ScopedNodeAffinity affinity(node);
+    cv::Mat image, mask;
+    replicas.get(node, image, mask);
+    task(image, mask);
+  }
+
+  // a specialization of detectAndComputeTask()
+  typedef void (AffineInvariantFeatureT::*DetectAndComputeTask)(
+      const cv::Mat &, const cv::Mat &, std::vector< cv::KeyPoint > &, cv::Mat &, const float,
+      const float) const;
+
+  template < bool Identity >
+  void computeTask(const cv::Mat &src_image, const std::vector< cv::KeyPoint > &src_keypoints,
+                   std::vector< cv::KeyPoint > &keypoints, cv::Mat &descriptors, const float phi,
+                   const float tilt) const {
+    CV_Assert(this->extractor_);
+    keypoints = src_keypoints;
+
+    // no warping for the identity simulation
+    if (Identity) {
+      this->extractor_->compute(src_image, keypoints, descriptors);
+      return;
+    }
+
     // apply the affine transformation to the image on the basis of the given parameters
     cv::Mat image(src_image.clone());
     cv::Matx23f affine;
@@ -158,16 +445,24 @@ protected:
     transformKeypoints(keypoints, affine);
 
     // extract descriptors on the skewed image and keypoints
-    CV_Assert(extractor_);
-    extractor_->compute(image, keypoints, descriptors);
+    this->extractor_->compute(image, keypoints, descriptors);
 
     // invert keypoints
     invertKeypoints(keypoints, affine);
   }
 
+  template < bool Identity >
   void detectTask(const cv::Mat &src_image, const cv::Mat &src_mask,
-                  std::vector< cv::KeyPoint > &keypoints, const double phi,
-                  const double tilt) const {
+                  std::vector< cv::KeyPoint > &keypoints, const float phi,
+                  const float tilt) const {
+    CV_Assert(this->detector_);
+
+    // no warping for the identity simulation
+    if (Identity) {
+      this->detector_->detect(src_image, keypoints, src_mask);
+      return;
+    }
+
     // apply the affine transformation to the image on the basis of the given parameters
     cv::Mat image(src_image.clone());
     cv::Matx23f affine;
@@ -178,46 +473,126 @@ protected:
     warpMask(mask, affine, image.size());
 
     // detect keypoints on the skewed image and mask
-    CV_Assert(detector_);
-    detector_->detect(image, keypoints, mask);
+    this->detector_->detect(image, keypoints, mask);
 
     // invert keypoints
     invertKeypoints(keypoints, affine);
   }
 
+  template < bool Identity, bool Shared >
   void detectAndComputeTask(const cv::Mat &src_image, const cv::Mat &src_mask,
                             std::vector< cv::KeyPoint > &keypoints, cv::Mat &descriptors,
-                            const double phi, const double tilt) const {
-    // apply the affine transformation to the image on the basis of the given parameters
-    cv::Mat image(src_image.clone());
+                            const float phi, const float tilt) const {
+    CV_Assert(this->detector_);
+    CV_Assert(this->extractor_);
+
+    // apply the affine transformation to the image and mask on the basis of the given parameters
+    // (no warping for the identity simulation)
+    cv::Mat image(src_image);
+    cv::Mat mask(src_mask);
     cv::Matx23f affine;
-    warpImage(image, affine, phi, tilt);
-
-    // if keypoints are not provided, first apply the affine transformation to the mask
-    cv::Mat mask(src_mask.empty() ? cv::Mat(src_image.size(), CV_8UC1, 255) : src_mask.clone());
-    warpMask(mask, affine, image.size());
+    if (!Identity) {
+      image = src_image.clone();
+      warpImage(image, affine, phi, tilt);
+      mask = src_mask.empty() ? cv::Mat(src_image.size(), CV_8UC1, 255) : src_mask.clone();
+      warpMask(mask, affine, image.size());
+    }
 
     // detect keypoints on the skewed image and mask
     // and extract descriptors on the image and keypoints
-    if (detector_ == extractor_) {
-      CV_Assert(detector_);
-      detector_->detectAndCompute(image, mask, keypoints, descriptors, false);
+    if (Shared) {
+      this->detector_->detectAndCompute(image, mask, keypoints, descriptors, false);
     } else {
-      CV_Assert(detector_);
-      CV_Assert(extractor_);
-      detector_->detect(image, keypoints, mask);
-      extractor_->compute(image, keypoints, descriptors);
+      this->detector_->detect(image, keypoints, mask);
+      this->extractor_->compute(image, keypoints, descriptors);
     }
 
     // invert the positions of the detected keypoints
-    invertKeypoints(keypoints, affine);
+    if (!Identity) {
+      invertKeypoints(keypoints, affine);
+    }
+  }
+
+  // inputs of updateTask()
+  struct UpdateRegion {
+    cv::Mat image;
+    cv::Mat mask;    // the new mask in the dirty region
+    cv::Mat dirty;   // the region to be re-extracted
+    cv::Rect bounds; // the bounding box of the dirty region
+    int band;
+  };
+
+  // run a simulation on a crop around the bounds with a margin of the band scaled by the tilt,
+  // and keep keypoints in the dirty region
+  void updateTask(const DetectAndComputeTask task, const UpdateRegion &region,
+                  std::vector< cv::KeyPoint > &keypoints, cv::Mat &descriptors, const float phi,
+                  const float tilt) const {
+    const int margin(cvCeil(region.band * tilt));
+    const cv::Rect crop(cv::Rect(region.bounds.x - margin, region.bounds.y - margin,
+                                 region.bounds.width + 2 * margin,
+                                 region.bounds.height + 2 * margin) &
+                        cv::Rect(0, 0, region.image.cols, region.image.rows));
+
+    std::vector< cv::KeyPoint > crop_keypoints;
+    cv::Mat crop_descriptors;
+    (this->*task)(region.image(crop), region.mask(crop), crop_keypoints, crop_descriptors, phi,
+                  tilt);
+
+    // move keypoints to the source frame. ones out of the dirty region
+    // (by rounding of the warped mask) are dropped because previous ones are kept there.
+    keypoints.clear();
+    std::vector< int > rows;
+    for (std::size_t i = 0; i < crop_keypoints.size(); ++i) {
+      cv::KeyPoint keypoint(crop_keypoints[i]);
+      keypoint.pt.x += crop.x;
+      keypoint.pt.y += crop.y;
+      if (isOnMask(region.dirty, keypoint.pt)) {
+        keypoints.push_back(keypoint);
+        rows.push_back(i);
+      }
+    }
+    descriptors.create(rows.size(), crop_descriptors.cols, crop_descriptors.type());
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+      crop_descriptors.row(rows[i]).copyTo(descriptors.row(i));
+    }
   }
 
-  static void warpImage(cv::Mat &image, cv::Matx23f &affine, const double phi, const double tilt) {
+  // 8-bit mask whose nonzero pixels are 255. an empty mask is the whole image.
+  static cv::Mat toBinaryMask(const cv::Mat &mask, const cv::Size &size) {
+    if (mask.empty()) {
+      return cv::Mat(size, CV_8UC1, cv::Scalar::all(255));
+    }
+    CV_Assert(mask.type() == CV_8UC1 && mask.size() == size);
+    return mask != 0;
+  }
+
+  static bool isOnMask(const cv::Mat &mask, const cv::Point2f &pt) {
+    const int x(cvFloor(pt.x)), y(cvFloor(pt.y));
+    return x >= 0 && y >= 0 && x < mask.cols && y < mask.rows && mask.at< uchar >(y, x) != 0;
+  }
+
+  // backends convert a color image into grayscale on every call.
+  // converting the source image once shares the conversion among all simulations
+  // and both of the detector and extractor, and also makes warping the image cheaper.
+  static cv::Mat toGray(const cv::Mat &image) {
+    cv::Mat gray;
+    switch (image.channels()) {
+    case 3:
+      cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+      return gray;
+    case 4:
+      cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+      return gray;
+    default:
+      return image;
+    }
+  }
+
+  static void warpImage(cv::Mat &image, cv::Matx23f &affine, const float phi, const float tilt) {
     // initiate output
     affine = cv::Matx23f::eye();
 
-    if (phi != 0.) {
+    if (phi != 0.f) {
       // rotate the source frame
       affine = cv::getRotationMatrix2D(cv::Point2f(0., 0.), phi, 1.);
       cv::Rect tmp_rect;
@@ -239,7 +614,7 @@ protected:
       // apply the final transformation to the image
       cv::warpAffine(image, image, affine, tmp_rect.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
     }
-    if (tilt != 1.) {
+    if (tilt != 1.f) {
       // shrink the image in width
       cv::GaussianBlur(image, image, cv::Size(0, 0), 0.8 * std::sqrt(tilt * tilt - 1.), 0.01);
       cv::resize(image, image, cv::Size(0, 0), 1. / tilt, 1., cv::INTER_NEAREST);
@@ -249,18 +624,14 @@ protected:
     }
   }
 
+  // the following functions are only used in non-identity simulations
+
   static void warpMask(cv::Mat &mask, const cv::Matx23f &affine, const cv::Size size) {
-    if (affine == cv::Matx23f::eye()) {
-      return;
-    }
     cv::warpAffine(mask, mask, affine, size, cv::INTER_NEAREST);
   }
 
   static void transformKeypoints(std::vector< cv::KeyPoint > &keypoints,
                                  const cv::Matx23f &affine) {
-    if (affine == cv::Matx23f::eye()) {
-      return;
-    }
     for (std::vector< cv::KeyPoint >::iterator keypoint = keypoints.begin();
          keypoint != keypoints.end(); ++keypoint) {
       // convert cv::Point2f to cv::Mat (1x1,2ch) without copying data.
@@ -271,48 +642,62 @@ protected:
   }
 
   static void invertKeypoints(std::vector< cv::KeyPoint > &keypoints, const cv::Matx23f &affine) {
-    if (affine == cv::Matx23f::eye()) {
-      return;
-    }
     cv::Matx23f invert_affine;
     cv::invertAffineTransform(affine, invert_affine);
     transformKeypoints(keypoints, invert_affine);
   }
 
-  static void extendKeypoints(const std::vector< std::vector< cv::KeyPoint > > &src,
-                              std::vector< cv::KeyPoint > &dst) {
-    dst.clear();
-    for (std::size_t i = 0; i < src.size(); ++i) {
-      dst.insert(dst.end(), src[i].begin(), src[i].end());
+  // append descriptors of the given simulations to the output which grows to the exact size.
+  // this reallocates the output, so call this once with all the simulations to append.
+  void appendDescriptors(const std::vector< cv::Mat > &src,
+                         const std::vector< std::size_t > &indices, cv::Mat &dst) const {
+    int nrows(dst.rows);
+    for (std::vector< std::size_t >::const_iterator i = indices.begin(); i != indices.end(); ++i) {
+      nrows += src[*i].rows;
     }
-  }
-
-  void extendDescriptors(const std::vector< cv::Mat > &src, cv::OutputArray dst) const {
-    // create the output array
-    int nrows(0);
-    for (std::size_t i = 0; i < src.size(); ++i) {
-      nrows += src[i].rows;
+    if (!dst.empty() && nrows == dst.rows) {
+      return;
     }
-    dst.create(nrows, descriptorSize(), descriptorType());
 
-    // fill the output array
-    cv::Mat dst_mat(dst.getMat());
+    cv::Mat grown(nrows, this->descriptorSize(), this->descriptorType());
     int rows(0);
-    for (std::size_t i = 0; i < src.size(); ++i) {
-      if (src[i].rows > 0) {
-        src[i].copyTo(dst_mat.rowRange(rows, rows + src[i].rows));
-        rows += src[i].rows;
+    if (dst.rows > 0) {
+      dst.copyTo(grown.rowRange(0, dst.rows));
+      rows = dst.rows;
+    }
+    for (std::vector< std::size_t >::const_iterator i = indices.begin(); i != indices.end(); ++i) {
+      if (src[*i].rows > 0) {
+        src[*i].copyTo(grown.rowRange(rows, rows + src[*i].rows));
+        rows += src[*i].rows;
       }
     }
+    dst = grown;
+  }
+
+  // pass the matrix to the output without copying if possible
+  static void setOutput(const cv::Mat &src, cv::OutputArray dst) {
+    if (dst.kind() == cv::_InputArray::MAT) {
+      dst.getMatRef() = src;
+    } else {
+      src.copyTo(dst);
+    }
   }
 
 protected:
-  std::vector< double > phi_params_;
-  std::vector< double > tilt_params_;
-  std::size_t ntasks_;
   const double nstripes_;
+  bool numa_aware_;
+  std::size_t memory_budget_;
+  double backend_bytes_per_pixel_;
+  std::size_t peak_memory_usage_;
 };
 
+//
+// AffineInvariantFeature with runtime backends and the ASIFT sampling
+//
+
+typedef AffineInvariantFeatureT< cv::Feature2D, cv::Feature2D, AsiftSamplingGrid >
+    AffineInvariantFeature;
+
 } // namespace affine_invariant_features
 
 #endif
\ No newline at end of file
@@ -7,23 +7,25 @@
 namespace affine_invariant_features {
 
 //
-// A base class of AffineInvariantFeature to hold a backend feature algorithm
+// A base class of AffineInvariantFeatureT to hold backend feature algorithms.
+// Detector and Extractor are cv::Feature2D or any types having the same member functions.
 //
 
-class AffineInvariantFeatureBase : public cv::Feature2D {
+template < class Detector, class Extractor >
+class AffineInvariantFeatureBaseT : public cv::Feature2D {
 protected:
-  AffineInvariantFeatureBase(const cv::Ptr< cv::Feature2D > detector,
-                             const cv::Ptr< cv::Feature2D > extractor)
+  AffineInvariantFeatureBaseT(const cv::Ptr< Detector > detector,
+                              const cv::Ptr< Extractor > extractor)
       : detector_(detector), extractor_(extractor) {}
 
 public:
-  virtual ~AffineInvariantFeatureBase() {}
+  virtual ~AffineInvariantFeatureBaseT() {}
 
   //
   // inherited functions from cv::Feature2D or its base class.
   // These just call corresponding one of the base feature.
   // detect(), compute(), detectAndCompute() and getDefaultName()
-  // are overloaded in AffineInvariantFeature.
+  // are overloaded in AffineInvariantFeatureT.
   //
 
   virtual int defaultNorm() const {
@@ -59,7 +61,7 @@ public:
     if (detector_) {
       detector_->read(fn);
     }
-    if (extractor_ && extractor_ != detector_) {
+    if (extractor_ && !sharesBackend()) {
       extractor_->read(fn);
     }
   }
@@ -68,7 +70,7 @@ public:
     if (detector_) {
       detector_->write(fs);
     }
-    if (extractor_ && extractor_ != detector_) {
+    if (extractor_ && !sharesBackend()) {
       extractor_->write(fs);
     }
   }
@@ -77,7 +79,7 @@ public:
     if (detector_) {
       detector_->clear();
     }
-    if (extractor_ && extractor_ != detector_) {
+    if (extractor_ && !sharesBackend()) {
       extractor_->clear();
     }
   }
@@ -86,16 +88,25 @@ public:
     if (detector_) {
       detector_->save(filename);
     }
-    if (extractor_ && extractor_ != detector_) {
+    if (extractor_ && !sharesBackend()) {
       extractor_->save(filename);
     }
   }
 
 protected:
-  const cv::Ptr< cv::Feature2D > detector_;
-  const cv::Ptr< cv::Feature2D > extractor_;
+  // true if the detector and extractor are the same instance
+  bool sharesBackend() const {
+    return static_cast< const void * >(detector_.get()) ==
+           static_cast< const void * >(extractor_.get());
+  }
+
+protected:
+  const cv::Ptr< Detector > detector_;
+  const cv::Ptr< Extractor > extractor_;
 };
 
+typedef AffineInvariantFeatureBaseT< cv::Feature2D, cv::Feature2D > AffineInvariantFeatureBase;
+
 } // namespace affine_invariant_features
 
 #endif
\ No newline at end of file
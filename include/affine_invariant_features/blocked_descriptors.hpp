@@ -0,0 +1,329 @@
+#ifndef AFFINE_INVARIANT_FEATURES_BLOCKED_DESCRIPTORS
+#define AFFINE_INVARIANT_FEATURES_BLOCKED_DESCRIPTORS
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/parallel_tasks.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/ref.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/hal.hpp>
+#include <opencv2/features2d.hpp>
+
+// the lane kernel is used only if the compiler emits a hardware popcount (e.g. -mpopcnt).
+// otherwise __builtin_popcountll is a library call per word, and rows of a block are compared
+// one by one by cv::hal::normHamming. define AIF_HARDWARE_POPCOUNT to 0 or 1 to override.
+#ifndef AIF_HARDWARE_POPCOUNT
+#if defined(__GNUC__) && (defined(__POPCNT__) || defined(__AVX512VPOPCNTDQ__))
+#define AIF_HARDWARE_POPCOUNT 1
+#else
+#define AIF_HARDWARE_POPCOUNT 0
+#endif
+#endif
+
+namespace affine_invariant_features {
+
+//
+// Binary descriptors in a blocked layout for brute force scans in Hamming distance.
+// Rows are grouped into blocks of LANES rows in a 64-byte aligned buffer.
+// With a hardware popcount, a block stores the first 64-bit words of its rows, then the second
+// words, and so on, so that each group of words fills a 64-byte cache line and a scan over
+// a block reads memory sequentially. Without it, a block stores its rows contiguously.
+// Float descriptors are not supported here. BlockedL2Matcher is the exact matcher for them,
+// whose matrix products are faster than this layout can be.
+// The source matrix is not modified.
+//
+
+class BlockedDescriptors {
+public:
+  enum { ALIGNMENT = 64, LANES = 8 };
+
+public:
+  BlockedDescriptors() : rows_(0), cols_(0), data_(NULL) {}
+
+  BlockedDescriptors(const cv::Mat &descriptors) { create(descriptors); }
+
+  virtual ~BlockedDescriptors() {}
+
+  void create(const cv::Mat &descriptors) {
+    CV_Assert(descriptors.empty() || descriptors.type() == CV_8UC1);
+    rows_ = descriptors.rows;
+
+    // one 64-bit word per 8 bytes (zero padded)
+    cols_ = (descriptors.cols + 7) / 8;
+    allocate();
+    boost::uint64_t *const data(reinterpret_cast< boost::uint64_t * >(data_));
+    std::vector< boost::uint64_t > words;
+    for (int i = 0; i < rows_; ++i) {
+      packWords(descriptors.ptr(i), descriptors.cols, words);
+      for (int j = 0; j < cols_; ++j) {
+        data[wordIndex(i, j)] = words[j];
+      }
+    }
+  }
+
+  bool empty() const { return rows_ == 0; }
+
+  int rows() const { return rows_; }
+
+  int numBlocks() const { return (rows_ + LANES - 1) / LANES; }
+
+  //
+  // kernels
+  //
+
+  // Hamming distances from the packed query (see prepareQuery()) to the rows of the block
+  // (LANES values)
+  void hammingBlock(const int block, const std::vector< boost::uint64_t > &query,
+                    float *dists) const {
+    const boost::uint64_t *const data(reinterpret_cast< const boost::uint64_t * >(data_) +
+                                      block * cols_ * LANES);
+#if AIF_HARDWARE_POPCOUNT
+    int acc[LANES] = {0};
+    for (int j = 0; j < cols_; ++j) {
+      const boost::uint64_t q(query[j]);
+      const boost::uint64_t *const lane(data + j * LANES);
+      for (int l = 0; l < LANES; ++l) {
+        acc[l] += __builtin_popcountll(lane[l] ^ q);
+      }
+    }
+    std::copy(acc, acc + LANES, dists);
+#else
+    const uchar *const q(query.empty() ? NULL : reinterpret_cast< const uchar * >(&query[0]));
+    for (int l = 0; l < LANES; ++l) {
+      dists[l] = cv::hal::normHamming(q, reinterpret_cast< const uchar * >(data + l * cols_),
+                                      cols_ * sizeof(boost::uint64_t));
+    }
+#endif
+  }
+
+  // convert a row of query descriptors into the representation of the kernel
+  void prepareQuery(const cv::Mat &query, const int row,
+                    std::vector< boost::uint64_t > &dst) const {
+    CV_Assert(query.type() == CV_8UC1 && (query.cols + 7) / 8 == cols_);
+    packWords(query.ptr(row), query.cols, dst);
+  }
+
+  // bytes of a binary descriptor into 64-bit words (zero padded)
+  static void packWords(const uchar *src, const int nbytes, std::vector< boost::uint64_t > &dst) {
+    dst.assign((nbytes + 7) / 8, 0);
+    if (nbytes > 0) {
+      std::memcpy(&dst[0], src, nbytes);
+    }
+  }
+
+private:
+  void allocate() {
+    const std::size_t bytes(std::size_t(numBlocks()) * cols_ * LANES * sizeof(boost::uint64_t));
+    buffer_.create(1, bytes + ALIGNMENT, CV_8UC1);
+    buffer_.setTo(cv::Scalar::all(0));
+    const std::size_t address(reinterpret_cast< std::size_t >(buffer_.data));
+    data_ = reinterpret_cast< uchar * >((address + ALIGNMENT - 1) & ~std::size_t(ALIGNMENT - 1));
+  }
+
+  // position of the j-th word of the i-th row in the buffer
+  std::size_t wordIndex(const int i, const int j) const {
+#if AIF_HARDWARE_POPCOUNT
+    return std::size_t(i / LANES) * cols_ * LANES + j * LANES + i % LANES;
+#else
+    return std::size_t(i) * cols_ + j;
+#endif
+  }
+
+private:
+  int rows_;
+  int cols_; // 64-bit words per row
+  cv::Mat buffer_;
+  uchar *data_; // aligned on buffer_
+};
+
+//
+// Exact brute force matcher in Hamming distance which converts train descriptors
+// into the blocked layout once on train(), and scans the blocks for queries in parallel.
+// The original train descriptors are kept as given (e.g. for serialization of results).
+// Use BlockedL2Matcher for float descriptors.
+//
+
+class BlockedDescriptorMatcher : public cv::DescriptorMatcher {
+public:
+  // queryBlockSize: the number of query rows processed by a parallel task
+  BlockedDescriptorMatcher(const int queryBlockSize = 64)
+      : query_block_size_(queryBlockSize), trained_(false) {
+    CV_Assert(query_block_size_ > 0);
+  }
+
+  virtual ~BlockedDescriptorMatcher() {}
+
+  //
+  // overloaded functions from cv::DescriptorMatcher
+  //
+
+  virtual void add(cv::InputArrayOfArrays descriptors) {
+    cv::DescriptorMatcher::add(descriptors);
+    trained_ = false;
+  }
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    blocked_ = BlockedDescriptors();
+    offsets_.clear();
+    trained_ = false;
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    if (trained_) {
+      return;
+    }
+
+    // merge all train descriptors, and then convert them into the blocked layout
+    offsets_.clear();
+    int nrows(0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      offsets_.push_back(nrows);
+      nrows += trainDescCollection[i].rows;
+    }
+    cv::Mat merged;
+    if (trainDescCollection.size() == 1) {
+      merged = trainDescCollection[0];
+    } else if (!trainDescCollection.empty()) {
+      cv::vconcat(trainDescCollection, merged);
+    }
+    if (!merged.empty() && merged.type() != CV_8UC1) {
+      CV_Error(cv::Error::StsUnsupportedFormat,
+               "BlockedDescriptorMatcher is for binary descriptors. "
+               "Use BlockedL2Matcher for float descriptors.");
+    }
+    blocked_.create(merged);
+
+    trained_ = true;
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(bool emptyTrainData = false) const {
+    cv::Ptr< BlockedDescriptorMatcher > matcher(new BlockedDescriptorMatcher(query_block_size_));
+    if (!emptyTrainData) {
+      for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+        matcher->add(trainDescCollection[i].clone());
+      }
+    }
+    return matcher;
+  }
+
+protected:
+  // (distance, row in the merged descriptors)
+  typedef std::pair< float, int > Neighbor;
+
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool compactResult) {
+    search(queryDescriptors.getMat(), k, -1.f, matches, compactResult);
+  }
+
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches, float maxDistance,
+                               cv::InputArrayOfArrays /* masks */, bool compactResult) {
+    search(queryDescriptors.getMat(), 0, maxDistance, matches, compactResult);
+  }
+
+  // k nearest neighbors if max_distance < 0. otherwise all neighbors within max_distance.
+  void search(const cv::Mat &query, const int k, const float max_distance,
+              std::vector< std::vector< cv::DMatch > > &matches, const bool compactResult) const {
+    CV_Assert(query.channels() == 1);
+    matches.clear();
+    if (blocked_.empty()) {
+      if (!compactResult) {
+        matches.resize(query.rows);
+      }
+      return;
+    }
+
+    // search neighbors of each query block in parallel
+    std::vector< std::vector< Neighbor > > neighbors(query.rows);
+    const int nblocks((query.rows + query_block_size_ - 1) / query_block_size_);
+    ParallelTasks tasks(nblocks);
+    for (int i = 0; i < nblocks; ++i) {
+      const cv::Range rows(i * query_block_size_,
+                           std::min((i + 1) * query_block_size_, query.rows));
+      tasks[i] = boost::bind(&BlockedDescriptorMatcher::searchBlock, this, boost::cref(query),
+                             rows, k, max_distance, boost::ref(neighbors));
+    }
+    cv::parallel_for_(cv::Range(0, nblocks), tasks);
+
+    // convert neighbors to matches
+    matches.clear();
+    matches.reserve(query.rows);
+    for (int i = 0; i < query.rows; ++i) {
+      if (compactResult && neighbors[i].empty()) {
+        continue;
+      }
+      matches.push_back(std::vector< cv::DMatch >());
+      for (std::vector< Neighbor >::const_iterator n = neighbors[i].begin();
+           n != neighbors[i].end(); ++n) {
+        matches.back().push_back(toDMatch(i, *n));
+      }
+    }
+  }
+
+  void searchBlock(const cv::Mat &query, const cv::Range &query_rows, const int k,
+                   const float max_distance,
+                   std::vector< std::vector< Neighbor > > &neighbors) const {
+    std::vector< boost::uint64_t > query_buffer;
+    const int lanes(BlockedDescriptors::LANES);
+    float dists[BlockedDescriptors::LANES];
+    for (int i = query_rows.start; i < query_rows.end; ++i) {
+      blocked_.prepareQuery(query, i, query_buffer);
+      std::vector< Neighbor > &row_neighbors(neighbors[i]);
+      for (int block = 0; block < blocked_.numBlocks(); ++block) {
+        blocked_.hammingBlock(block, query_buffer, dists);
+        const int nlanes(std::min(lanes, blocked_.rows() - block * lanes));
+        for (int l = 0; l < nlanes; ++l) {
+          const Neighbor neighbor(dists[l], block * lanes + l);
+          if (max_distance < 0.f) {
+            insertNeighbor(row_neighbors, k, neighbor);
+          } else if (neighbor.first <= max_distance) {
+            row_neighbors.push_back(neighbor);
+          }
+        }
+      }
+      if (max_distance >= 0.f) {
+        std::sort(row_neighbors.begin(), row_neighbors.end());
+      }
+    }
+  }
+
+  // insert a neighbor to the list sorted in ascending order of distance, keeping its size <= k
+  static void insertNeighbor(std::vector< Neighbor > &neighbors, const int k,
+                             const Neighbor &neighbor) {
+    if (neighbors.size() >= static_cast< std::size_t >(k) && !(neighbor < neighbors.back())) {
+      return;
+    }
+    neighbors.insert(std::upper_bound(neighbors.begin(), neighbors.end(), neighbor), neighbor);
+    if (neighbors.size() > static_cast< std::size_t >(k)) {
+      neighbors.pop_back();
+    }
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Neighbor &neighbor) const {
+    // find which train descriptors the merged row belongs to
+    const int img_idx(std::upper_bound(offsets_.begin(), offsets_.end(), neighbor.second) -
+                      offsets_.begin() - 1);
+    return cv::DMatch(query_idx, neighbor.second - offsets_[img_idx], img_idx, neighbor.first);
+  }
+
+protected:
+  const int query_block_size_;
+  BlockedDescriptors blocked_;
+  std::vector< int > offsets_;
+  bool trained_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
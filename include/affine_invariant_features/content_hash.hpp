@@ -0,0 +1,475 @@
+#ifndef AFFINE_INVARIANT_FEATURES_CONTENT_HASH
+#define AFFINE_INVARIANT_FEATURES_CONTENT_HASH
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+
+#include <opencv2/core.hpp>
+
+#include <openssl/evp.h>
+
+#include <sys/stat.h>
+#include <time.h>
+
+namespace affine_invariant_features {
+
+//
+// XXH64, a fast non-cryptographic hash (https://github.com/Cyan4973/xxHash)
+//
+
+class XXH64 {
+public:
+  XXH64(const boost::uint64_t seed = 0) : total_len_(0), buffer_size_(0) {
+    v_[0] = seed + prime(1) + prime(2);
+    v_[1] = seed + prime(2);
+    v_[2] = seed;
+    v_[3] = seed - prime(1);
+    seed_ = seed;
+  }
+
+  void update(const void *data, const std::size_t len) {
+    const unsigned char *p(static_cast< const unsigned char * >(data));
+    const unsigned char *const end(p + len);
+    total_len_ += len;
+
+    // fill the buffer of an incomplete stripe
+    if (buffer_size_ + len < 32) {
+      std::memcpy(buffer_ + buffer_size_, p, len);
+      buffer_size_ += len;
+      return;
+    }
+    if (buffer_size_ > 0) {
+      std::memcpy(buffer_ + buffer_size_, p, 32 - buffer_size_);
+      consumeStripe(buffer_);
+      p += 32 - buffer_size_;
+      buffer_size_ = 0;
+    }
+
+    // consume complete stripes
+    for (; p + 32 <= end; p += 32) {
+      consumeStripe(p);
+    }
+
+    // keep the remaining
+    std::memcpy(buffer_, p, end - p);
+    buffer_size_ = end - p;
+  }
+
+  boost::uint64_t digest() const {
+    boost::uint64_t h;
+    if (total_len_ >= 32) {
+      h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+      for (int i = 0; i < 4; ++i) {
+        h ^= round(0, v_[i]);
+        h = h * prime(1) + prime(4);
+      }
+    } else {
+      h = seed_ + prime(5);
+    }
+    h += total_len_;
+
+    const unsigned char *p(buffer_);
+    const unsigned char *const end(buffer_ + buffer_size_);
+    for (; p + 8 <= end; p += 8) {
+      h ^= round(0, read64(p));
+      h = rotl(h, 27) * prime(1) + prime(4);
+    }
+    if (p + 4 <= end) {
+      h ^= static_cast< boost::uint64_t >(read32(p)) * prime(1);
+      h = rotl(h, 23) * prime(2) + prime(3);
+      p += 4;
+    }
+    for (; p < end; ++p) {
+      h ^= (*p) * prime(5);
+      h = rotl(h, 11) * prime(1);
+    }
+
+    h ^= h >> 33;
+    h *= prime(2);
+    h ^= h >> 29;
+    h *= prime(3);
+    h ^= h >> 32;
+    return h;
+  }
+
+  std::string hexdigest() const {
+    std::ostringstream oss;
+    oss << std::hex << std::setw(16) << std::setfill('0') << digest();
+    return oss.str();
+  }
+
+  // check the implementation against reference vectors of xxHash.
+  // hashes are persisted in target and cache files so any deviation must be detected.
+  static bool selfTest() {
+    unsigned char sequence[101];
+    for (int i = 0; i < 101; ++i) {
+      sequence[i] = static_cast< unsigned char >(i);
+    }
+    const char *const fox("The quick brown fox jumps over the lazy dog");
+    return hash("", 0, 0) == 0xef46db3751d8e999ULL && hash("a", 1, 0) == 0xd24ec4f1a98c6e5bULL &&
+           hash("abc", 3, 0) == 0x44bc2cf5ad770999ULL &&
+           hash(fox, std::strlen(fox), 0) == 0x0b242d361fda71bcULL &&
+           hash(sequence, 101, 0) == 0xe99038495f85381eULL &&
+           hash(sequence, 101, 2654435761ULL) == 0xa1c6d4174c37136dULL &&
+           // the same input fed in pieces which straddle stripes
+           hashInPieces(sequence, 101, 7) == 0xe99038495f85381eULL;
+  }
+
+private:
+  static boost::uint64_t hash(const void *data, const std::size_t len,
+                              const boost::uint64_t seed) {
+    XXH64 xxh64(seed);
+    xxh64.update(data, len);
+    return xxh64.digest();
+  }
+
+  static boost::uint64_t hashInPieces(const unsigned char *data, const std::size_t len,
+                                      const std::size_t piece) {
+    XXH64 xxh64;
+    for (std::size_t i = 0; i < len; i += piece) {
+      xxh64.update(data + i, std::min(piece, len - i));
+    }
+    return xxh64.digest();
+  }
+
+  static boost::uint64_t prime(const int i) {
+    static const boost::uint64_t primes[] = {0ULL, 11400714785074694791ULL, 14029467366897019727ULL,
+                                             1609587929392839161ULL, 9650029242287828579ULL,
+                                             2870177450012600261ULL};
+    return primes[i];
+  }
+
+  static boost::uint64_t rotl(const boost::uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  static boost::uint64_t round(boost::uint64_t acc, const boost::uint64_t input) {
+    acc += input * prime(2);
+    acc = rotl(acc, 31);
+    acc *= prime(1);
+    return acc;
+  }
+
+  // little endian is assumed
+  static boost::uint64_t read64(const unsigned char *p) {
+    boost::uint64_t val;
+    std::memcpy(&val, p, sizeof(val));
+    return val;
+  }
+
+  static boost::uint32_t read32(const unsigned char *p) {
+    boost::uint32_t val;
+    std::memcpy(&val, p, sizeof(val));
+    return val;
+  }
+
+  void consumeStripe(const unsigned char *p) {
+    for (int i = 0; i < 4; ++i) {
+      v_[i] = round(v_[i], read64(p + 8 * i));
+    }
+  }
+
+private:
+  boost::uint64_t seed_;
+  boost::uint64_t v_[4];
+  boost::uint64_t total_len_;
+  unsigned char buffer_[32];
+  std::size_t buffer_size_;
+};
+
+//
+// Hashes of file contents. Files are read in large chunks,
+// and the hashes are cached with stamps of the files (device, inode, size,
+// and modification and status change times in nanoseconds) so that unchanged files
+// are not rehashed. A file changed shortly before it was hashed could be changed again
+// without a new timestamp, so such a hash is never cached and the file is always rehashed.
+// The cache can persist across processes in one file of a cache directory
+// (see setCacheDirectory()). A new hash is appended to the file,
+// which is compacted when it is loaded with many outdated lines.
+//
+
+class ContentHash {
+public:
+  // hash the file content with the given type ("md5" or "xxh64").
+  // returns an empty string if the file could not be read or the type is unknown.
+  static std::string generate(const std::string &path, const std::string &type) {
+    namespace bf = boost::filesystem;
+
+    // find the cached hash
+    FileStamp stamp;
+    if (!getStamp(path, stamp)) {
+      return std::string();
+    }
+    const bf::path abs_path(bf::absolute(path));
+    const CacheKey key(std::make_pair(abs_path.string(), type));
+    {
+      const cv::AutoLock lock(cacheMutex());
+      loadCacheFile();
+      const Cache::const_iterator cached(cache().find(key));
+      if (cached != cache().end() && cached->second.stamp == stamp &&
+          isSettled(cached->second)) {
+        return cached->second.hash;
+      }
+    }
+
+    // calculate the hash
+    const boost::int64_t hashed(now());
+    std::string hash;
+    if (type == "md5") {
+      hash = generateMD5(path);
+    } else if (type == "xxh64") {
+      static const bool xxh64_ok(XXH64::selfTest());
+      CV_Assert(xxh64_ok);
+      hash = generateXXH64(path);
+    }
+    if (hash.empty()) {
+      return hash;
+    }
+
+    // cache the hash unless the file was changed during or shortly before hashing
+    FileStamp hashed_stamp;
+    CacheValue value;
+    value.stamp = stamp;
+    value.hashed = hashed;
+    value.hash = hash;
+    if (!getStamp(path, hashed_stamp) || !(hashed_stamp == stamp) || !isSettled(value)) {
+      return hash;
+    }
+    {
+      const cv::AutoLock lock(cacheMutex());
+      cache()[key] = value;
+      if (!cacheDirectory().empty()) {
+        std::ofstream ofs(cacheFilePath().c_str(), std::ios::app);
+        writeEntry(ofs, key, value);
+      }
+    }
+    return hash;
+  }
+
+  // clear the cache in memory. the cache file is kept and reloaded on demand.
+  static void clearCache() {
+    const cv::AutoLock lock(cacheMutex());
+    cache().clear();
+    cacheLoaded() = false;
+  }
+
+  // keep the cache in a file of the directory so that other processes can reuse it
+  // (e.g. the directory of FeatureCache). an empty directory disables the file (default).
+  static void setCacheDirectory(const std::string &directory) {
+    const cv::AutoLock lock(cacheMutex());
+    if (!directory.empty()) {
+      boost::system::error_code error;
+      boost::filesystem::create_directories(directory, error);
+    }
+    cacheDirectory() = directory;
+    cacheLoaded() = false;
+  }
+
+  static std::string generateMD5(const std::string &path) {
+    EVP_MD_CTX *const ctx(EVP_MD_CTX_create());
+    EVP_DigestInit_ex(ctx, EVP_md5(), NULL);
+    const bool ok(readFile(path, &updateMD5, ctx));
+    unsigned char md5[EVP_MAX_MD_SIZE];
+    unsigned int md5_len(0);
+    EVP_DigestFinal_ex(ctx, md5, &md5_len);
+    EVP_MD_CTX_destroy(ctx);
+    if (!ok) {
+      return std::string();
+    }
+
+    // stringaze the MD5 hash
+    std::ostringstream oss;
+    for (unsigned int i = 0; i < md5_len; ++i) {
+      oss << std::hex << std::setw(2) << std::setfill('0') << static_cast< int >(md5[i]);
+    }
+    return oss.str();
+  }
+
+  static std::string generateXXH64(const std::string &path) {
+    XXH64 xxh64;
+    if (!readFile(path, &updateXXH64, &xxh64)) {
+      return std::string();
+    }
+    return xxh64.hexdigest();
+  }
+
+private:
+  typedef std::pair< std::string, std::string > CacheKey; // (absolute path, type)
+  struct FileStamp {
+    boost::uint64_t device, inode, size;
+    boost::int64_t mtime, ctime; // in nanoseconds since the epoch
+
+    bool operator==(const FileStamp &other) const {
+      return device == other.device && inode == other.inode && size == other.size &&
+             mtime == other.mtime && ctime == other.ctime;
+    }
+  };
+  struct CacheValue {
+    FileStamp stamp;
+    boost::int64_t hashed; // when hashing started, in nanoseconds since the epoch
+    std::string hash;
+  };
+  typedef std::map< CacheKey, CacheValue > Cache;
+
+  // a coarse bound of timestamp resolutions of file systems (2 s of FAT, 1 s of HFS+ or ext3,
+  // and a scheduler tick of others) and of clock differences to network file systems
+  static boost::int64_t timestampGranularity() { return 2000000000; }
+
+  static bool getStamp(const std::string &path, FileStamp &stamp) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      return false;
+    }
+    stamp.device = st.st_dev;
+    stamp.inode = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtime = toNanoseconds(st.st_mtim);
+    stamp.ctime = toNanoseconds(st.st_ctim);
+    return true;
+  }
+
+  static boost::int64_t toNanoseconds(const timespec &ts) {
+    return static_cast< boost::int64_t >(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  static boost::int64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return toNanoseconds(ts);
+  }
+
+  // true if the file was not changed within the timestamp granularity before hashing.
+  // otherwise, a change after hashing may have left the stamp unchanged.
+  static bool isSettled(const CacheValue &value) {
+    return std::max(value.stamp.mtime, value.stamp.ctime) + timestampGranularity() <
+           value.hashed;
+  }
+
+  static Cache &cache() {
+    static Cache cache;
+    return cache;
+  }
+
+  static cv::Mutex &cacheMutex() {
+    static cv::Mutex mutex;
+    return mutex;
+  }
+
+  static std::string &cacheDirectory() {
+    static std::string directory;
+    return directory;
+  }
+
+  static bool &cacheLoaded() {
+    static bool loaded(false);
+    return loaded;
+  }
+
+  static std::string cacheFilePath() {
+    return (boost::filesystem::path(cacheDirectory()) / "content_hashes").string();
+  }
+
+  // one entry per line:
+  // "<type> <device> <inode> <size> <mtime> <ctime> <hashed> <hash> <absolute path>".
+  // later lines override earlier ones of the same path and type.
+  static void writeEntry(std::ostream &os, const CacheKey &key, const CacheValue &value) {
+    os << key.second << ' ' << value.stamp.device << ' ' << value.stamp.inode << ' '
+       << value.stamp.size << ' ' << value.stamp.mtime << ' ' << value.stamp.ctime << ' '
+       << value.hashed << ' ' << value.hash << ' ' << key.first << '\n';
+  }
+
+  // merge the cache file into the cache once per process.
+  // the cache mutex must be locked.
+  static void loadCacheFile() {
+    namespace bf = boost::filesystem;
+
+    if (cacheDirectory().empty() || cacheLoaded()) {
+      return;
+    }
+    cacheLoaded() = true;
+
+    const std::string cache_file(cacheFilePath());
+    std::ifstream ifs(cache_file.c_str());
+    if (!ifs) {
+      return;
+    }
+    std::set< CacheKey > keys;
+    std::size_t nlines(0);
+    std::string line;
+    while (std::getline(ifs, line)) {
+      ++nlines;
+      std::istringstream iss(line);
+      CacheKey key;
+      CacheValue value;
+      if (!(iss >> key.second >> value.stamp.device >> value.stamp.inode >> value.stamp.size >>
+            value.stamp.mtime >> value.stamp.ctime >> value.hashed >> value.hash) ||
+          iss.get() != ' ' || !std::getline(iss, key.first) || key.first.empty()) {
+        continue;
+      }
+      cache()[key] = value;
+      keys.insert(key);
+    }
+    ifs.close();
+
+    // rewrite the cache file without outdated lines.
+    // renaming a complete temporary file keeps the cache file intact for other processes,
+    // and a unique name keeps compactions by different processes apart.
+    if (nlines > 2 * keys.size() + 16) {
+      const bf::path tmp(bf::path(cacheDirectory()) /
+                         bf::unique_path("content_hashes.%%%%-%%%%-%%%%-%%%%.tmp"));
+      std::ofstream ofs(tmp.string().c_str());
+      for (std::set< CacheKey >::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+        writeEntry(ofs, *key, cache()[*key]);
+      }
+      ofs.close();
+      boost::system::error_code error;
+      if (ofs) {
+        bf::rename(tmp, cache_file, error);
+      }
+      if (!ofs || error) {
+        bf::remove(tmp, error);
+      }
+    }
+  }
+
+  // read the file in 1MB chunks and pass them to the given function
+  static bool readFile(const std::string &path,
+                       void (*update)(void *, const char *, const std::size_t), void *ctx) {
+    std::FILE *const file(std::fopen(path.c_str(), "rb"));
+    if (!file) {
+      return false;
+    }
+    std::vector< char > buf(1 << 20);
+    std::size_t len;
+    while ((len = std::fread(&buf[0], 1, buf.size(), file)) > 0) {
+      update(ctx, &buf[0], len);
+    }
+    const bool ok(!std::ferror(file));
+    std::fclose(file);
+    return ok;
+  }
+
+  static void updateMD5(void *ctx, const char *data, const std::size_t len) {
+    EVP_DigestUpdate(static_cast< EVP_MD_CTX * >(ctx), data, len);
+  }
+
+  static void updateXXH64(void *ctx, const char *data, const std::size_t len) {
+    static_cast< XXH64 * >(ctx)->update(data, len);
+  }
+};
+
+} // namespace affine_invariant_features
+
+#endif
@@ -63,6 +63,32 @@ static inline void write(cv::FileStorage &fs, const std::string &, const CvSeria
   val.write(fs);
 }
 
+//
+// Macros to implement utility functions which create or read variants of a CvSerializable
+//
+
+#define AIF_APPEND_DEFAULT_NAME(names, type)                                                       \
+  do {                                                                                             \
+    const cv::Ptr< type > params(new type());                                                      \
+    names.push_back(params->getDefaultName());                                                     \
+  } while (false)
+
+#define AIF_RETURN_IF_CREATE(type)                                                                 \
+  do {                                                                                             \
+    const cv::Ptr< type > params(new type());                                                      \
+    if (type_name == params->getDefaultName()) {                                                   \
+      return params;                                                                               \
+    }                                                                                              \
+  } while (false)
+
+#define AIF_RETURN_IF_LOAD(type)                                                                   \
+  do {                                                                                             \
+    const cv::Ptr< type > params(load< type >(fn));                                                \
+    if (params) {                                                                                  \
+      return params;                                                                               \
+    }                                                                                              \
+  } while (false)
+
 } // namespace affine_invariant_features
 
 #endif
\ No newline at end of file
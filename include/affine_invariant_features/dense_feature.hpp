@@ -0,0 +1,139 @@
+#ifndef AFFINE_INVARIANT_FEATURES_DENSE_FEATURE
+#define AFFINE_INVARIANT_FEATURES_DENSE_FEATURE
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Keypoints on a regular multi-scale grid (keypoint detector only).
+// The number of keypoints is proportional to the area of the image rather than its texture.
+// Grid points outside the mask or on flat patches (whose standard deviation of intensities
+// is less than minContrast) are dropped. Means and variances of patches are looked up
+// from integral images, which are computed in one pass over the image.
+//
+
+class DenseFeatureDetector : public cv::Feature2D {
+public:
+  // size: diameter of keypoints in the first level
+  // levels: the number of levels
+  // scaleFactor: ratio of sizes of keypoints between adjacent levels
+  // step: distance between grid points in the first level, which is scaled with the size
+  // minContrast: minimum standard deviation of intensities in a keypoint (0 to disable)
+  DenseFeatureDetector(const float size = 12.f, const int levels = 3,
+                       const float scaleFactor = 1.5f, const float step = 6.f,
+                       const float minContrast = 0.f)
+      : size_(size), levels_(levels), scale_factor_(scaleFactor), step_(step),
+        min_contrast_(minContrast) {
+    CV_Assert(size_ > 0.f && levels_ > 0 && scale_factor_ > 0.f && step_ > 0.f);
+  }
+
+  virtual ~DenseFeatureDetector() {}
+
+  static cv::Ptr< DenseFeatureDetector > create(const float size = 12.f, const int levels = 3,
+                                                const float scaleFactor = 1.5f,
+                                                const float step = 6.f,
+                                                const float minContrast = 0.f) {
+    return new DenseFeatureDetector(size, levels, scaleFactor, step, minContrast);
+  }
+
+  //
+  // overloaded functions from cv::Feature2D
+  //
+
+  virtual void detectAndCompute(cv::InputArray src_image, cv::InputArray src_mask,
+                                std::vector< cv::KeyPoint > &keypoints,
+                                cv::OutputArray descriptors, bool useProvidedKeypoints) {
+    if (useProvidedKeypoints || descriptors.needed()) {
+      CV_Error(cv::Error::StsNotImplemented, "DenseFeatureDetector is a detector only");
+    }
+
+    keypoints.clear();
+    const cv::Mat image(src_image.getMat());
+    const cv::Mat mask(src_mask.getMat());
+    CV_Assert(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == image.size()));
+    if (image.empty()) {
+      return;
+    }
+
+    // integral images of intensities and their squares for contrasts of patches
+    cv::Mat sum, sqsum;
+    if (min_contrast_ > 0.f) {
+      cv::Mat gray;
+      if (image.channels() == 1) {
+        gray = image;
+      } else {
+        cv::cvtColor(image, gray, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+      }
+      cv::integral(gray, sum, sqsum, CV_64F, CV_64F);
+    }
+
+    const float sq_min_contrast(min_contrast_ * min_contrast_);
+    float size(size_), step(step_);
+    for (int level = 0; level < levels_; ++level, size *= scale_factor_, step *= scale_factor_) {
+      // grid points whose keypoints are fully inside the image
+      const int radius(static_cast< int >(std::ceil(size / 2.f)));
+      if (2 * radius >= image.cols || 2 * radius >= image.rows) {
+        break;
+      }
+      for (float y = radius; y < image.rows - radius; y += step) {
+        const int iy(static_cast< int >(y));
+        const uchar *const mask_row(mask.empty() ? NULL : mask.ptr< uchar >(iy));
+        for (float x = radius; x < image.cols - radius; x += step) {
+          const int ix(static_cast< int >(x));
+          if (mask_row && mask_row[ix] == 0) {
+            continue;
+          }
+          float response(0.f);
+          if (!sum.empty()) {
+            response = patchVariance(sum, sqsum, ix, iy, radius);
+            if (response < sq_min_contrast) {
+              continue;
+            }
+          }
+          keypoints.push_back(cv::KeyPoint(x, y, size, -1.f, std::sqrt(response), level));
+        }
+      }
+    }
+  }
+
+  virtual int descriptorSize() const { return 0; }
+
+  virtual int descriptorType() const { return CV_32F; }
+
+  virtual int defaultNorm() const { return cv::NORM_L2; }
+
+  virtual cv::String getDefaultName() const { return "DenseFeatureDetector"; }
+
+private:
+  // variance of intensities in the square patch of the radius around (x, y)
+  static float patchVariance(const cv::Mat &sum, const cv::Mat &sqsum, const int x, const int y,
+                             const int radius) {
+    const int x0(x - radius), y0(y - radius), x1(x + radius + 1), y1(y + radius + 1);
+    const double area((x1 - x0) * (y1 - y0));
+    const double s(sum.at< double >(y1, x1) - sum.at< double >(y0, x1) -
+                   sum.at< double >(y1, x0) + sum.at< double >(y0, x0));
+    const double sq(sqsum.at< double >(y1, x1) - sqsum.at< double >(y0, x1) -
+                    sqsum.at< double >(y1, x0) + sqsum.at< double >(y0, x0));
+    const double mean(s / area);
+    return static_cast< float >(std::max(sq / area - mean * mean, 0.));
+  }
+
+private:
+  const float size_;
+  const int levels_;
+  const float scale_factor_;
+  const float step_;
+  const float min_contrast_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
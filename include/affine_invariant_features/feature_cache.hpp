@@ -0,0 +1,189 @@
+#ifndef AFFINE_INVARIANT_FEATURES_FEATURE_CACHE
+#define AFFINE_INVARIANT_FEATURES_FEATURE_CACHE
+
+#include <algorithm>
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/content_hash.hpp>
+#include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/target.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+
+#include <opencv2/core.hpp>
+
+namespace affine_invariant_features {
+
+//
+// On-disk cache of extraction results, keyed by the content of the target image,
+// the feature parameters and the target contour.
+// Least recently used entries are evicted when the cache exceeds its size limit.
+//
+
+class FeatureCache {
+public:
+  // bump this when the format of entries or results of the same parameters change
+  // so that entries written by older versions are never hit
+  enum { VERSION = 1 };
+
+public:
+  // max_bytes = 0 means unlimited
+  FeatureCache(const std::string &directory, const boost::uintmax_t max_bytes = 0)
+      : directory_(directory), max_bytes_(max_bytes) {
+    boost::filesystem::create_directories(directory_);
+  }
+
+  virtual ~FeatureCache() {}
+
+  // generate a key of the extraction. returns an empty string if the target cannot be hashed.
+  static std::string generateKey(const FeatureParameters &params,
+                                 const TargetDescription &target) {
+    const std::string content_hash(ContentHash::generate(
+        TargetDescription::resolvePath(target.package, target.path), "xxh64"));
+    if (content_hash.empty()) {
+      return std::string();
+    }
+
+    // serialize the parameters in a canonical form
+    std::string params_str;
+    {
+      cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+      params.save(fs);
+      params_str = fs.releaseAndGetString();
+    }
+
+    // entries of other versions of this package or OpenCV, whose algorithms may differ,
+    // get different keys
+    const std::string version(cv::format("FeatureCache %d OpenCV %s", VERSION, CV_VERSION));
+
+    XXH64 xxh64;
+    xxh64.update(version.data(), version.size());
+    xxh64.update(content_hash.data(), content_hash.size());
+    xxh64.update(params_str.data(), params_str.size());
+    for (std::vector< cv::Point >::const_iterator point = target.contour.begin();
+         point != target.contour.end(); ++point) {
+      const int xy[] = {point->x, point->y};
+      xxh64.update(xy, sizeof(xy));
+    }
+    return xxh64.hexdigest();
+  }
+
+  // load cached results. returns an empty pointer if not cached.
+  cv::Ptr< Results > load(const std::string &key) const {
+    namespace bf = boost::filesystem;
+
+    if (key.empty()) {
+      return cv::Ptr< Results >();
+    }
+
+    const bf::path path(entryPath(key));
+    if (!bf::exists(path)) {
+      return cv::Ptr< Results >();
+    }
+
+    cv::Ptr< Results > results;
+    {
+      const cv::FileStorage file(path.string(), cv::FileStorage::READ);
+      if (!file.isOpened()) {
+        return cv::Ptr< Results >();
+      }
+      results = affine_invariant_features::load< Results >(file.root());
+    }
+
+    // mark the entry as recently used
+    if (results) {
+      boost::system::error_code error;
+      bf::last_write_time(path, std::time(NULL), error);
+    }
+    return results;
+  }
+
+  // store results, and then evict old entries if the cache is too large
+  void save(const std::string &key, const Results &results) {
+    namespace bf = boost::filesystem;
+
+    if (key.empty()) {
+      return;
+    }
+
+    // write to a temporary file and then rename it
+    // so that other processes never read an incomplete entry
+    const bf::path path(entryPath(key));
+    const bf::path tmp_path(directory_ / bf::unique_path("%%%%-%%%%-%%%%-%%%%.tmp.yml.gz"));
+    {
+      cv::FileStorage file(tmp_path.string(), cv::FileStorage::WRITE);
+      if (!file.isOpened()) {
+        return;
+      }
+      results.save(file);
+    }
+    boost::system::error_code error;
+    bf::rename(tmp_path, path, error);
+    if (error) {
+      bf::remove(tmp_path, error);
+      return;
+    }
+
+    evict();
+  }
+
+  // remove least recently used entries until the cache fits the size limit
+  void evict() {
+    namespace bf = boost::filesystem;
+
+    if (max_bytes_ == 0) {
+      return;
+    }
+
+    // list entries with their last used time
+    std::vector< std::pair< std::time_t, bf::path > > entries;
+    boost::uintmax_t total_bytes(0);
+    for (bf::directory_iterator it(directory_); it != bf::directory_iterator(); ++it) {
+      if (!isEntry(it->path())) {
+        continue;
+      }
+      boost::system::error_code error;
+      const boost::uintmax_t bytes(bf::file_size(it->path(), error));
+      const std::time_t mtime(bf::last_write_time(it->path(), error));
+      if (error) {
+        continue;
+      }
+      total_bytes += bytes;
+      entries.push_back(std::make_pair(mtime, it->path()));
+    }
+
+    // remove from the oldest
+    std::sort(entries.begin(), entries.end());
+    for (std::size_t i = 0; i < entries.size() && total_bytes > max_bytes_; ++i) {
+      boost::system::error_code error;
+      const boost::uintmax_t bytes(bf::file_size(entries[i].second, error));
+      if (!error && bf::remove(entries[i].second, error)) {
+        total_bytes -= bytes;
+      }
+    }
+  }
+
+private:
+  boost::filesystem::path entryPath(const std::string &key) const {
+    return directory_ / (key + ".yml.gz");
+  }
+
+  static bool isEntry(const boost::filesystem::path &path) {
+    const std::string name(path.filename().string());
+    return name.size() > 7 && name.compare(name.size() - 7, 7, ".yml.gz") == 0 &&
+           name.find(".tmp.") == std::string::npos;
+  }
+
+private:
+  const boost::filesystem::path directory_;
+  const boost::uintmax_t max_bytes_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
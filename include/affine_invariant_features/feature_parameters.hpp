@@ -6,6 +6,8 @@
 
 #include <affine_invariant_features/affine_invariant_feature.hpp>
 #include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/dense_feature.hpp>
+#include <affine_invariant_features/hessian_sift_feature.hpp>
 
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
@@ -24,6 +26,14 @@ public:
   virtual ~FeatureParameters() {}
 
   virtual cv::Ptr< cv::Feature2D > createFeature() const = 0;
+
+  // whether the feature created by createFeature() detects keypoints and computes descriptors.
+  // a detector-only or extractor-only parameter set is valid only as the detector (1st entry)
+  // or the extractor (2nd entry) of AIFParameters, and an error is raised by the feature
+  // when it is asked for what it does not support.
+  virtual bool isDetector() const { return true; }
+
+  virtual bool isExtractor() const { return true; }
 };
 
 //
@@ -47,6 +57,11 @@ public:
       return AffineInvariantFeature::create((*this)[0] ? (*this)[0]->createFeature()
                                                        : cv::Ptr< cv::Feature2D >());
     default:
+      // use one backend as both of the detector and extractor if they are equivalent
+      // so that its scale space is built once per simulation in detectAndCompute()
+      if (isEquivalent((*this)[0], (*this)[1])) {
+        return AffineInvariantFeature::create((*this)[0]->createFeature());
+      }
       return AffineInvariantFeature::create(
           (*this)[0] ? (*this)[0]->createFeature() : cv::Ptr< cv::Feature2D >(),
           (*this)[1] ? (*this)[1]->createFeature() : cv::Ptr< cv::Feature2D >());
@@ -79,7 +94,29 @@ public:
     }
   }
 
+  virtual bool isDetector() const { return !empty() && (*this)[0] && (*this)[0]->isDetector(); }
+
+  // the only entry works as both of the detector and extractor
+  virtual bool isExtractor() const {
+    const std::size_t i(size() == 1 ? 0 : 1);
+    return i < size() && (*this)[i] && (*this)[i]->isExtractor();
+  }
+
   virtual std::string getDefaultName() const { return "AIFParameters"; }
+
+protected:
+  // true if both parameter sets have the same type and values
+  static bool isEquivalent(const cv::Ptr< const FeatureParameters > &a,
+                           const cv::Ptr< const FeatureParameters > &b) {
+    if (!a || !b) {
+      return false;
+    }
+    cv::FileStorage fs_a(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+    a->save(fs_a);
+    cv::FileStorage fs_b(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+    b->save(fs_b);
+    return fs_a.releaseAndGetString() == fs_b.releaseAndGetString();
+  }
 };
 
 //
@@ -142,6 +179,33 @@ public:
   int diffusivity;
 };
 
+//
+// BRIEF (descriptor extractor only, e.g. the extractor of AIFParameters)
+//
+
+struct BRIEFParameters : public FeatureParameters {
+public:
+  // Note: no interface to access default BRIEF parameters
+  BRIEFParameters() : bytes(32) {}
+
+  virtual ~BRIEFParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return cv::xfeatures2d::BriefDescriptorExtractor::create(bytes);
+  }
+
+  virtual void read(const cv::FileNode &fn) { fn["bytes"] >> bytes; }
+
+  virtual void write(cv::FileStorage &fs) const { fs << "bytes" << bytes; }
+
+  virtual bool isDetector() const { return false; }
+
+  virtual std::string getDefaultName() const { return "BRIEFParameters"; }
+
+public:
+  int bytes; // 16, 32 or 64
+};
+
 //
 // BRISK
 //
@@ -177,6 +241,301 @@ public:
   float patternScale;
 };
 
+//
+// Dense grid (keypoint detector only, e.g. the detector of AIFParameters)
+//
+
+struct DenseParameters : public FeatureParameters {
+public:
+  DenseParameters() : size(12.f), levels(3), scaleFactor(1.5f), step(6.f), minContrast(0.f) {}
+
+  virtual ~DenseParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return DenseFeatureDetector::create(size, levels, scaleFactor, step, minContrast);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["size"] >> size;
+    fn["levels"] >> levels;
+    fn["scaleFactor"] >> scaleFactor;
+    fn["step"] >> step;
+    fn["minContrast"] >> minContrast;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "size" << size;
+    fs << "levels" << levels;
+    fs << "scaleFactor" << scaleFactor;
+    fs << "step" << step;
+    fs << "minContrast" << minContrast;
+  }
+
+  virtual bool isExtractor() const { return false; }
+
+  virtual std::string getDefaultName() const { return "DenseParameters"; }
+
+public:
+  float size;
+  int levels;
+  float scaleFactor;
+  float step;
+  float minContrast;
+};
+
+//
+// FAST (keypoint detector only, e.g. the detector of AIFParameters)
+//
+
+struct FASTParameters : public FeatureParameters {
+public:
+  FASTParameters()
+      : threshold(defaultFAST().getThreshold()),
+        nonmaxSuppression(defaultFAST().getNonmaxSuppression()), type(defaultFAST().getType()) {}
+
+  virtual ~FASTParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return cv::FastFeatureDetector::create(threshold, nonmaxSuppression, type);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["threshold"] >> threshold;
+    fn["nonmaxSuppression"] >> nonmaxSuppression;
+    fn["type"] >> type;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "threshold" << threshold;
+    fs << "nonmaxSuppression" << nonmaxSuppression;
+    fs << "type" << type;
+  }
+
+  virtual bool isExtractor() const { return false; }
+
+  virtual std::string getDefaultName() const { return "FASTParameters"; }
+
+protected:
+  static const cv::FastFeatureDetector &defaultFAST() {
+    static cv::Ptr< const cv::FastFeatureDetector > default_fast(
+        cv::FastFeatureDetector::create());
+    CV_Assert(default_fast);
+    return *default_fast;
+  }
+
+public:
+  int threshold;
+  bool nonmaxSuppression;
+  int type;
+};
+
+//
+// FREAK (descriptor extractor only, e.g. the extractor of AIFParameters)
+//
+
+struct FREAKParameters : public FeatureParameters {
+public:
+  // Note: no interface to access default FREAK parameters
+  FREAKParameters()
+      : orientationNormalized(true), scaleNormalized(true), patternScale(22.f), nOctaves(4) {}
+
+  virtual ~FREAKParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return cv::xfeatures2d::FREAK::create(orientationNormalized, scaleNormalized, patternScale,
+                                          nOctaves);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["orientationNormalized"] >> orientationNormalized;
+    fn["scaleNormalized"] >> scaleNormalized;
+    fn["patternScale"] >> patternScale;
+    fn["nOctaves"] >> nOctaves;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "orientationNormalized" << orientationNormalized;
+    fs << "scaleNormalized" << scaleNormalized;
+    fs << "patternScale" << patternScale;
+    fs << "nOctaves" << nOctaves;
+  }
+
+  virtual bool isDetector() const { return false; }
+
+  virtual std::string getDefaultName() const { return "FREAKParameters"; }
+
+public:
+  bool orientationNormalized;
+  bool scaleNormalized;
+  float patternScale;
+  int nOctaves;
+};
+
+//
+// GFTT (keypoint detector only, e.g. the detector of AIFParameters)
+//
+
+struct GFTTParameters : public FeatureParameters {
+public:
+  GFTTParameters()
+      : maxCorners(defaultGFTT().getMaxFeatures()), qualityLevel(defaultGFTT().getQualityLevel()),
+        minDistance(defaultGFTT().getMinDistance()), blockSize(defaultGFTT().getBlockSize()),
+        useHarrisDetector(defaultGFTT().getHarrisDetector()), k(defaultGFTT().getK()) {}
+
+  virtual ~GFTTParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return cv::GFTTDetector::create(maxCorners, qualityLevel, minDistance, blockSize,
+                                    useHarrisDetector, k);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["maxCorners"] >> maxCorners;
+    fn["qualityLevel"] >> qualityLevel;
+    fn["minDistance"] >> minDistance;
+    fn["blockSize"] >> blockSize;
+    fn["useHarrisDetector"] >> useHarrisDetector;
+    fn["k"] >> k;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "maxCorners" << maxCorners;
+    fs << "qualityLevel" << qualityLevel;
+    fs << "minDistance" << minDistance;
+    fs << "blockSize" << blockSize;
+    fs << "useHarrisDetector" << useHarrisDetector;
+    fs << "k" << k;
+  }
+
+  virtual bool isExtractor() const { return false; }
+
+  virtual std::string getDefaultName() const { return "GFTTParameters"; }
+
+protected:
+  static const cv::GFTTDetector &defaultGFTT() {
+    static cv::Ptr< const cv::GFTTDetector > default_gftt(cv::GFTTDetector::create());
+    CV_Assert(default_gftt);
+    return *default_gftt;
+  }
+
+public:
+  int maxCorners;
+  double qualityLevel;
+  double minDistance;
+  int blockSize;
+  bool useHarrisDetector;
+  double k;
+};
+
+//
+// Hessian-SIFT (determinant-of-Hessian keypoints and SIFT descriptors on one scale space,
+// e.g. instead of a pair of SURF detector and SIFT extractor)
+//
+
+struct HessianSiftParameters : public FeatureParameters {
+public:
+  HessianSiftParameters()
+      : detThreshold(100.), upright(false), nfeatures(0), nOctaveLayers(3), sigma(1.6) {}
+
+  virtual ~HessianSiftParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return HessianSiftFeature::create(detThreshold, upright, nfeatures, nOctaveLayers, sigma);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["detThreshold"] >> detThreshold;
+    fn["upright"] >> upright;
+    fn["nfeatures"] >> nfeatures;
+    fn["nOctaveLayers"] >> nOctaveLayers;
+    fn["sigma"] >> sigma;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "detThreshold" << detThreshold;
+    fs << "upright" << upright;
+    fs << "nfeatures" << nfeatures;
+    fs << "nOctaveLayers" << nOctaveLayers;
+    fs << "sigma" << sigma;
+  }
+
+  virtual std::string getDefaultName() const { return "HessianSiftParameters"; }
+
+public:
+  // threshold on the scale-normalized determinant of Hessian (see HessianSiftFeature).
+  // this is not on the scale of hessianThreshold of SURF.
+  double detThreshold;
+  bool upright;
+  int nfeatures;
+  int nOctaveLayers;
+  double sigma;
+};
+
+//
+// ORB
+//
+
+struct ORBParameters : public FeatureParameters {
+public:
+  ORBParameters()
+      : nfeatures(defaultORB().getMaxFeatures()), scaleFactor(defaultORB().getScaleFactor()),
+        nlevels(defaultORB().getNLevels()), edgeThreshold(defaultORB().getEdgeThreshold()),
+        firstLevel(defaultORB().getFirstLevel()), WTA_K(defaultORB().getWTA_K()),
+        scoreType(defaultORB().getScoreType()), patchSize(defaultORB().getPatchSize()),
+        fastThreshold(defaultORB().getFastThreshold()) {}
+
+  virtual ~ORBParameters() {}
+
+  virtual cv::Ptr< cv::Feature2D > createFeature() const {
+    return cv::ORB::create(nfeatures, scaleFactor, nlevels, edgeThreshold, firstLevel, WTA_K,
+                           scoreType, patchSize, fastThreshold);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["nfeatures"] >> nfeatures;
+    fn["scaleFactor"] >> scaleFactor;
+    fn["nlevels"] >> nlevels;
+    fn["edgeThreshold"] >> edgeThreshold;
+    fn["firstLevel"] >> firstLevel;
+    fn["WTA_K"] >> WTA_K;
+    fn["scoreType"] >> scoreType;
+    fn["patchSize"] >> patchSize;
+    fn["fastThreshold"] >> fastThreshold;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "nfeatures" << nfeatures;
+    fs << "scaleFactor" << scaleFactor;
+    fs << "nlevels" << nlevels;
+    fs << "edgeThreshold" << edgeThreshold;
+    fs << "firstLevel" << firstLevel;
+    fs << "WTA_K" << WTA_K;
+    fs << "scoreType" << scoreType;
+    fs << "patchSize" << patchSize;
+    fs << "fastThreshold" << fastThreshold;
+  }
+
+  virtual std::string getDefaultName() const { return "ORBParameters"; }
+
+protected:
+  static const cv::ORB &defaultORB() {
+    static cv::Ptr< const cv::ORB > default_orb(cv::ORB::create());
+    CV_Assert(default_orb);
+    return *default_orb;
+  }
+
+public:
+  int nfeatures;
+  double scaleFactor;
+  int nlevels;
+  int edgeThreshold;
+  int firstLevel;
+  int WTA_K;
+  int scoreType;
+  int patchSize;
+  int fastThreshold;
+};
+
 //
 // SIFT
 //
@@ -276,51 +635,50 @@ public:
 // Utility functions to create or read variants of FeatureParameters
 //
 
-#define AIF_APPEND_DEFAULT_NAME(names, type)                                                       \
-  do {                                                                                             \
-    const cv::Ptr< type > params(new type());                                                      \
-    names.push_back(params->getDefaultName());                                                     \
-  } while (false)
-
 static inline std::vector< std::string > getFeatureParameterNames() {
   std::vector< std::string > names;
   AIF_APPEND_DEFAULT_NAME(names, AIFParameters);
   AIF_APPEND_DEFAULT_NAME(names, AKAZEParameters);
+  AIF_APPEND_DEFAULT_NAME(names, BRIEFParameters);
   AIF_APPEND_DEFAULT_NAME(names, BRISKParameters);
+  AIF_APPEND_DEFAULT_NAME(names, DenseParameters);
+  AIF_APPEND_DEFAULT_NAME(names, FASTParameters);
+  AIF_APPEND_DEFAULT_NAME(names, FREAKParameters);
+  AIF_APPEND_DEFAULT_NAME(names, GFTTParameters);
+  AIF_APPEND_DEFAULT_NAME(names, HessianSiftParameters);
+  AIF_APPEND_DEFAULT_NAME(names, ORBParameters);
   AIF_APPEND_DEFAULT_NAME(names, SIFTParameters);
   AIF_APPEND_DEFAULT_NAME(names, SURFParameters);
   return names;
 }
 
-#define AIF_RETURN_IF_CREATE(type)                                                                 \
-  do {                                                                                             \
-    const cv::Ptr< type > params(new type());                                                      \
-    if (type_name == params->getDefaultName()) {                                                   \
-      return params;                                                                               \
-    }                                                                                              \
-  } while (false)
-
 static inline cv::Ptr< FeatureParameters > createFeatureParameters(const std::string &type_name) {
   AIF_RETURN_IF_CREATE(AIFParameters);
   AIF_RETURN_IF_CREATE(AKAZEParameters);
+  AIF_RETURN_IF_CREATE(BRIEFParameters);
   AIF_RETURN_IF_CREATE(BRISKParameters);
+  AIF_RETURN_IF_CREATE(DenseParameters);
+  AIF_RETURN_IF_CREATE(FASTParameters);
+  AIF_RETURN_IF_CREATE(FREAKParameters);
+  AIF_RETURN_IF_CREATE(GFTTParameters);
+  AIF_RETURN_IF_CREATE(HessianSiftParameters);
+  AIF_RETURN_IF_CREATE(ORBParameters);
   AIF_RETURN_IF_CREATE(SIFTParameters);
   AIF_RETURN_IF_CREATE(SURFParameters);
   return cv::Ptr< FeatureParameters >();
 }
 
-#define AIF_RETURN_IF_LOAD(type)                                                                   \
-  do {                                                                                             \
-    const cv::Ptr< type > params(load< type >(fn));                                                \
-    if (params) {                                                                                  \
-      return params;                                                                               \
-    }                                                                                              \
-  } while (false)
-
 template <> cv::Ptr< FeatureParameters > load< FeatureParameters >(const cv::FileNode &fn) {
   AIF_RETURN_IF_LOAD(AIFParameters);
   AIF_RETURN_IF_LOAD(AKAZEParameters);
+  AIF_RETURN_IF_LOAD(BRIEFParameters);
   AIF_RETURN_IF_LOAD(BRISKParameters);
+  AIF_RETURN_IF_LOAD(DenseParameters);
+  AIF_RETURN_IF_LOAD(FASTParameters);
+  AIF_RETURN_IF_LOAD(FREAKParameters);
+  AIF_RETURN_IF_LOAD(GFTTParameters);
+  AIF_RETURN_IF_LOAD(HessianSiftParameters);
+  AIF_RETURN_IF_LOAD(ORBParameters);
   AIF_RETURN_IF_LOAD(SIFTParameters);
   AIF_RETURN_IF_LOAD(SURFParameters);
   return cv::Ptr< FeatureParameters >();
@@ -0,0 +1,521 @@
+#ifndef AFFINE_INVARIANT_FEATURES_HAMMING_MATCHERS
+#define AFFINE_INVARIANT_FEATURES_HAMMING_MATCHERS
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/unordered_set.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A base class of matchers for binary descriptors with a custom search index.
+// Train descriptors are merged into a single matrix on train(),
+// and then derived classes build their indices on it.
+//
+
+class HammingIndexMatcher : public cv::DescriptorMatcher {
+protected:
+  HammingIndexMatcher() : trained_(false) {}
+
+public:
+  virtual ~HammingIndexMatcher() {}
+
+  //
+  // overloaded functions from cv::DescriptorMatcher
+  //
+
+  virtual void add(cv::InputArrayOfArrays descriptors) {
+    cv::DescriptorMatcher::add(descriptors);
+    trained_ = false;
+  }
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    merged_ = cv::Mat();
+    offsets_.clear();
+    trained_ = false;
+    clearIndex();
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    if (trained_) {
+      return;
+    }
+
+    // merge all train descriptors into one matrix
+    offsets_.clear();
+    int nrows(0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      CV_Assert(trainDescCollection[i].type() == CV_8UC1);
+      offsets_.push_back(nrows);
+      nrows += trainDescCollection[i].rows;
+    }
+    if (trainDescCollection.size() == 1) {
+      merged_ = trainDescCollection[0];
+    } else if (!trainDescCollection.empty()) {
+      cv::vconcat(trainDescCollection, merged_);
+    }
+
+    clearIndex();
+    buildIndex();
+    trained_ = true;
+  }
+
+  // number of different bits between two binary descriptors
+  static int hammingDistance(const uchar *a, const uchar *b, const int n) {
+    static const uchar popcount[256] = {
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4,
+        4, 5, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5,
+        4, 5, 5, 6, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4,
+        4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6,
+        4, 5, 5, 6, 5, 6, 6, 7, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4,
+        4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5,
+        4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4,
+        4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+        4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8};
+    int dist(0);
+    for (int i = 0; i < n; ++i) {
+      dist += popcount[a[i] ^ b[i]];
+    }
+    return dist;
+  }
+
+protected:
+  // (distance, row in the merged descriptors)
+  typedef std::pair< int, int > Neighbor;
+
+  // build the index on merged_
+  virtual void buildIndex() = 0;
+
+  // release the index
+  virtual void clearIndex() = 0;
+
+  // find k nearest rows of merged_ from the query in ascending order of distance
+  virtual void knnSearch(const uchar *query, const int k,
+                         std::vector< Neighbor > &neighbors) const = 0;
+
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool compactResult) {
+    const cv::Mat query(queryDescriptors.getMat());
+    CV_Assert(query.type() == CV_8UC1 && query.cols == merged_.cols);
+
+    matches.clear();
+    matches.reserve(query.rows);
+    std::vector< Neighbor > neighbors;
+    for (int i = 0; i < query.rows; ++i) {
+      knnSearch(query.ptr(i), k, neighbors);
+      if (compactResult && neighbors.empty()) {
+        continue;
+      }
+      matches.push_back(std::vector< cv::DMatch >());
+      for (std::vector< Neighbor >::const_iterator n = neighbors.begin(); n != neighbors.end();
+           ++n) {
+        matches.back().push_back(toDMatch(i, *n));
+      }
+    }
+  }
+
+  // radius search is rare in this package. thus it just scans all train descriptors.
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches, float maxDistance,
+                               cv::InputArrayOfArrays /* masks */, bool compactResult) {
+    const cv::Mat query(queryDescriptors.getMat());
+    CV_Assert(query.type() == CV_8UC1 && query.cols == merged_.cols);
+
+    matches.clear();
+    matches.reserve(query.rows);
+    std::vector< Neighbor > neighbors;
+    for (int i = 0; i < query.rows; ++i) {
+      neighbors.clear();
+      for (int j = 0; j < merged_.rows; ++j) {
+        const int dist(hammingDistance(query.ptr(i), merged_.ptr(j), merged_.cols));
+        if (dist <= maxDistance) {
+          neighbors.push_back(Neighbor(dist, j));
+        }
+      }
+      if (compactResult && neighbors.empty()) {
+        continue;
+      }
+      std::sort(neighbors.begin(), neighbors.end());
+      matches.push_back(std::vector< cv::DMatch >());
+      for (std::vector< Neighbor >::const_iterator n = neighbors.begin(); n != neighbors.end();
+           ++n) {
+        matches.back().push_back(toDMatch(i, *n));
+      }
+    }
+  }
+
+  // insert a neighbor to the list sorted in ascending order of distance, keeping its size <= k
+  static void insertNeighbor(std::vector< Neighbor > &neighbors, const int k,
+                             const Neighbor &neighbor) {
+    if (neighbors.size() >= static_cast< std::size_t >(k) && !(neighbor < neighbors.back())) {
+      return;
+    }
+    neighbors.insert(std::upper_bound(neighbors.begin(), neighbors.end(), neighbor), neighbor);
+    if (neighbors.size() > static_cast< std::size_t >(k)) {
+      neighbors.pop_back();
+    }
+  }
+
+  int distance(const uchar *query, const int row) const {
+    return hammingDistance(query, merged_.ptr(row), merged_.cols);
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Neighbor &neighbor) const {
+    // find which train descriptors the merged row belongs to
+    const int img_idx(std::upper_bound(offsets_.begin(), offsets_.end(), neighbor.second) -
+                      offsets_.begin() - 1);
+    return cv::DMatch(query_idx, neighbor.second - offsets_[img_idx], img_idx, neighbor.first);
+  }
+
+protected:
+  cv::Mat merged_;
+  std::vector< int > offsets_;
+  bool trained_;
+};
+
+//
+// Multi-index hashing (Norouzi et al., CVPR 2012).
+// Each descriptor is split into substrings which are indexed by separate hash tables.
+// A query probes the tables with keys at increasing Hamming radius
+// until the pigeonhole principle guarantees the k nearest neighbors are found.
+//
+
+class MultiIndexHashingMatcher : public HammingIndexMatcher {
+public:
+  // substringBytes: length of each substring in bytes (1 to 4)
+  // maxRadius: the maximum radius to probe each table. negative means unlimited (exact search).
+  // maxChecks: the maximum number of distance computations per query. 0 means unlimited.
+  MultiIndexHashingMatcher(const int substringBytes = 2, const int maxRadius = -1,
+                           const int maxChecks = 0)
+      : substring_bytes_(substringBytes), max_radius_(maxRadius), max_checks_(maxChecks) {
+    CV_Assert(substring_bytes_ >= 1 && substring_bytes_ <= 4);
+  }
+
+  virtual ~MultiIndexHashingMatcher() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(bool emptyTrainData = false) const {
+    const cv::Ptr< MultiIndexHashingMatcher > matcher(
+        new MultiIndexHashingMatcher(substring_bytes_, max_radius_, max_checks_));
+    if (!emptyTrainData) {
+      for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+        matcher->add(trainDescCollection[i].clone());
+      }
+    }
+    return matcher;
+  }
+
+protected:
+  typedef boost::uint32_t Key;
+
+  struct SearchState {
+    const uchar *query;
+    int k;
+    int checks;
+    boost::unordered_set< int > visited;
+    std::vector< Neighbor > neighbors;
+  };
+
+  virtual void buildIndex() {
+    const int nsubstrings((merged_.cols + substring_bytes_ - 1) / substring_bytes_);
+    keys_.resize(nsubstrings);
+    rows_.resize(nsubstrings);
+    for (int j = 0; j < nsubstrings; ++j) {
+      // sort (key, row) pairs of the j-th substrings so that a key can be found by binary search
+      std::vector< std::pair< Key, int > > table(merged_.rows);
+      for (int i = 0; i < merged_.rows; ++i) {
+        table[i] = std::make_pair(substringKey(merged_.ptr(i), j), i);
+      }
+      std::sort(table.begin(), table.end());
+      keys_[j].resize(table.size());
+      rows_[j].resize(table.size());
+      for (std::size_t i = 0; i < table.size(); ++i) {
+        keys_[j][i] = table[i].first;
+        rows_[j][i] = table[i].second;
+      }
+    }
+  }
+
+  virtual void clearIndex() {
+    keys_.clear();
+    rows_.clear();
+  }
+
+  virtual void knnSearch(const uchar *query, const int k,
+                         std::vector< Neighbor > &neighbors) const {
+    SearchState state;
+    state.query = query;
+    state.k = k;
+    state.checks = 0;
+
+    const int nsubstrings(keys_.size());
+    const int max_radius(max_radius_ < 0 ? 8 * substring_bytes_
+                                         : std::min(max_radius_, 8 * substring_bytes_));
+    for (int radius = 0; radius <= max_radius; ++radius) {
+      for (int j = 0; j < nsubstrings; ++j) {
+        probeTable(j, substringKey(query, j), 0, radius, state);
+      }
+      // any descriptor not found yet differs from the query
+      // at more than the radius in all substrings
+      if (state.neighbors.size() >= static_cast< std::size_t >(k) &&
+          state.neighbors.back().first <= nsubstrings * (radius + 1)) {
+        break;
+      }
+      if (max_checks_ > 0 && state.checks >= max_checks_) {
+        break;
+      }
+    }
+
+    neighbors.swap(state.neighbors);
+  }
+
+  // look up the j-th table with keys which differ from the given key at nflips bits
+  // whose positions are not less than the given first bit
+  void probeTable(const int j, const Key key, const int first_bit, const int nflips,
+                  SearchState &state) const {
+    if (max_checks_ > 0 && state.checks >= max_checks_) {
+      return;
+    }
+    if (nflips == 0) {
+      lookupTable(j, key, state);
+      return;
+    }
+    const int nbits(8 * substringLength(j));
+    for (int bit = first_bit; bit <= nbits - nflips; ++bit) {
+      probeTable(j, key ^ (Key(1) << bit), bit + 1, nflips - 1, state);
+    }
+  }
+
+  void lookupTable(const int j, const Key key, SearchState &state) const {
+    const std::pair< std::vector< Key >::const_iterator, std::vector< Key >::const_iterator >
+        range(std::equal_range(keys_[j].begin(), keys_[j].end(), key));
+    for (std::vector< Key >::const_iterator it = range.first; it != range.second; ++it) {
+      const int row(rows_[j][it - keys_[j].begin()]);
+      if (!state.visited.insert(row).second) {
+        continue;
+      }
+      insertNeighbor(state.neighbors, state.k, Neighbor(distance(state.query, row), row));
+      ++state.checks;
+    }
+  }
+
+  int substringLength(const int j) const {
+    return std::min(substring_bytes_, merged_.cols - j * substring_bytes_);
+  }
+
+  Key substringKey(const uchar *descriptor, const int j) const {
+    Key key(0);
+    const uchar *const begin(descriptor + j * substring_bytes_);
+    for (int i = substringLength(j) - 1; i >= 0; --i) {
+      key = (key << 8) | begin[i];
+    }
+    return key;
+  }
+
+protected:
+  const int substring_bytes_;
+  const int max_radius_;
+  const int max_checks_;
+  // sorted keys of substrings and corresponding rows for each table
+  std::vector< std::vector< Key > > keys_;
+  std::vector< std::vector< int > > rows_;
+};
+
+//
+// Hierarchical navigable small world graph (Malkov & Yashunin, TPAMI 2018)
+// for approximate nearest neighbor search in Hamming space
+//
+
+class HNSWMatcher : public HammingIndexMatcher {
+public:
+  // M: the number of links per node on upper layers (2 * M on the bottom layer)
+  // efConstruction: the size of the dynamic candidate list on building the graph
+  // efSearch: the size of the dynamic candidate list on searching. larger is slower but accurate.
+  // seed: the seed of random layer assignment
+  HNSWMatcher(const int M = 16, const int efConstruction = 100, const int efSearch = 64,
+              const int seed = 0)
+      : M_(M), ef_construction_(efConstruction), ef_search_(efSearch), seed_(seed),
+        entry_point_(-1), max_level_(-1) {
+    CV_Assert(M_ >= 2);
+  }
+
+  virtual ~HNSWMatcher() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(bool emptyTrainData = false) const {
+    const cv::Ptr< HNSWMatcher > matcher(
+        new HNSWMatcher(M_, ef_construction_, ef_search_, seed_));
+    if (!emptyTrainData) {
+      for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+        matcher->add(trainDescCollection[i].clone());
+      }
+    }
+    return matcher;
+  }
+
+protected:
+  virtual void buildIndex() {
+    cv::RNG rng(seed_);
+    const double level_mult(1. / std::log(static_cast< double >(M_)));
+    links_.resize(merged_.rows);
+    for (int i = 0; i < merged_.rows; ++i) {
+      insertNode(i, static_cast< int >(-std::log(1. - rng.uniform(0., 1.)) * level_mult));
+    }
+  }
+
+  virtual void clearIndex() {
+    links_.clear();
+    entry_point_ = -1;
+    max_level_ = -1;
+  }
+
+  virtual void knnSearch(const uchar *query, const int k,
+                         std::vector< Neighbor > &neighbors) const {
+    neighbors.clear();
+    if (entry_point_ < 0) {
+      return;
+    }
+
+    Neighbor entry(distance(query, entry_point_), entry_point_);
+    for (int level = max_level_; level > 0; --level) {
+      entry = searchGreedy(query, entry, level);
+    }
+    searchLayer(query, entry, std::max(ef_search_, k), 0, neighbors);
+    if (neighbors.size() > static_cast< std::size_t >(k)) {
+      neighbors.resize(k);
+    }
+  }
+
+  void insertNode(const int node, const int level) {
+    links_[node].resize(level + 1);
+    if (entry_point_ < 0) {
+      entry_point_ = node;
+      max_level_ = level;
+      return;
+    }
+
+    // descend upper layers greedily
+    const uchar *const query(merged_.ptr(node));
+    Neighbor entry(distance(query, entry_point_), entry_point_);
+    for (int l = max_level_; l > level; --l) {
+      entry = searchGreedy(query, entry, l);
+    }
+
+    // link the node to its nearest neighbors on each layer
+    std::vector< Neighbor > candidates;
+    for (int l = std::min(level, max_level_); l >= 0; --l) {
+      searchLayer(query, entry, ef_construction_, l, candidates);
+      const std::size_t max_links(l == 0 ? 2 * M_ : M_);
+      for (std::size_t i = 0; i < candidates.size() && i < static_cast< std::size_t >(M_); ++i) {
+        const int neighbor(candidates[i].second);
+        links_[node][l].push_back(neighbor);
+        links_[neighbor][l].push_back(node);
+        if (links_[neighbor][l].size() > max_links) {
+          shrinkLinks(neighbor, l, max_links);
+        }
+      }
+      entry = candidates.front();
+    }
+
+    if (level > max_level_) {
+      entry_point_ = node;
+      max_level_ = level;
+    }
+  }
+
+  // keep the nearest links of the node
+  void shrinkLinks(const int node, const int level, const std::size_t max_links) {
+    std::vector< int > &links(links_[node][level]);
+    std::vector< Neighbor > neighbors;
+    for (std::vector< int >::const_iterator link = links.begin(); link != links.end(); ++link) {
+      neighbors.push_back(Neighbor(distance(merged_.ptr(node), *link), *link));
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    links.clear();
+    for (std::size_t i = 0; i < max_links; ++i) {
+      links.push_back(neighbors[i].second);
+    }
+  }
+
+  Neighbor searchGreedy(const uchar *query, Neighbor entry, const int level) const {
+    bool changed(true);
+    while (changed) {
+      changed = false;
+      const std::vector< int > &links(links_[entry.second][level]);
+      for (std::vector< int >::const_iterator link = links.begin(); link != links.end(); ++link) {
+        const int dist(distance(query, *link));
+        if (dist < entry.first) {
+          entry = Neighbor(dist, *link);
+          changed = true;
+        }
+      }
+    }
+    return entry;
+  }
+
+  // find ef nearest nodes on the layer in ascending order of distance
+  void searchLayer(const uchar *query, const Neighbor &entry, const int ef, const int level,
+                   std::vector< Neighbor > &results) const {
+    boost::unordered_set< int > visited;
+    std::priority_queue< Neighbor, std::vector< Neighbor >, std::greater< Neighbor > > candidates;
+    std::priority_queue< Neighbor > nearests;
+    visited.insert(entry.second);
+    candidates.push(entry);
+    nearests.push(entry);
+
+    while (!candidates.empty()) {
+      const Neighbor candidate(candidates.top());
+      if (candidate.first > nearests.top().first) {
+        break;
+      }
+      candidates.pop();
+
+      const std::vector< int > &links(links_[candidate.second][level]);
+      for (std::vector< int >::const_iterator link = links.begin(); link != links.end(); ++link) {
+        if (!visited.insert(*link).second) {
+          continue;
+        }
+        const Neighbor neighbor(distance(query, *link), *link);
+        if (nearests.size() < static_cast< std::size_t >(ef) ||
+            neighbor.first < nearests.top().first) {
+          candidates.push(neighbor);
+          nearests.push(neighbor);
+          if (nearests.size() > static_cast< std::size_t >(ef)) {
+            nearests.pop();
+          }
+        }
+      }
+    }
+
+    results.resize(nearests.size());
+    for (int i = results.size() - 1; i >= 0; --i) {
+      results[i] = nearests.top();
+      nearests.pop();
+    }
+  }
+
+protected:
+  const int M_;
+  const int ef_construction_;
+  const int ef_search_;
+  const int seed_;
+  // links_[node][level] = linked nodes
+  std::vector< std::vector< std::vector< int > > > links_;
+  int entry_point_;
+  int max_level_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
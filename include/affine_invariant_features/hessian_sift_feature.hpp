@@ -0,0 +1,527 @@
+// orientationHist() and siftDescriptor() of HessianSiftFeature below are ported from
+// modules/xfeatures2d/src/sift.cpp of opencv_contrib, which is distributed under
+// the following license.
+//
+//                          License Agreement
+//                For Open Source Computer Vision Library
+//
+// Copyright (C) 2000-2008, Intel Corporation, all rights reserved.
+// Copyright (C) 2009, Willow Garage Inc., all rights reserved.
+// Third party copyrights are property of their respective owners.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//   * Redistribution's of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistribution's in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   * The name of the copyright holders may not be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// This software is provided by the copyright holders and contributors "as is" and
+// any express or implied warranties, including, but not limited to, the implied
+// warranties of merchantability and fitness for a particular purpose are disclaimed.
+// In no event shall the Intel Corporation or contributors be liable for any direct,
+// indirect, incidental, special, exemplary, or consequential damages
+// (including, but not limited to, procurement of substitute goods or services;
+// loss of use, data, or profits; or business interruption) however caused
+// and on any theory of liability, whether in contract, strict liability,
+// or tort (including negligence or otherwise) arising in any way out of
+// the use of this software, even if advised of the possibility of such damage.
+//
+// The implementation of SIFT in opencv_contrib is in turn based on the code by Rob Hess
+// (Copyright (c) 2006-2010, Rob Hess <hess@eecs.oregonstate.edu>, all rights reserved).
+
+#ifndef AFFINE_INVARIANT_FEATURES_HESSIAN_SIFT_FEATURE
+#define AFFINE_INVARIANT_FEATURES_HESSIAN_SIFT_FEATURE
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A Gaussian scale space in the layout of SIFT.
+// The source image is upsampled by 2 into the first octave, and each octave has
+// nOctaveLayers + 3 levels whose blur grows by 2^(1 / nOctaveLayers) from sigma.
+//
+
+class GaussianScaleSpace {
+public:
+  GaussianScaleSpace(const int nOctaveLayers = 3, const double sigma = 1.6)
+      : layers_(nOctaveLayers), sigma_(sigma) {
+    CV_Assert(layers_ > 0 && sigma_ > 0.);
+  }
+
+  // build levels from an 8-bit or float grayscale image
+  void build(const cv::Mat &image) {
+    CV_Assert(image.channels() == 1);
+    levels_.clear();
+    if (image.empty()) {
+      return;
+    }
+
+    // the first level. the source image is assumed to be blurred by 0.5,
+    // which is doubled by the upsampling.
+    cv::Mat base;
+    image.convertTo(base, CV_32F);
+    cv::resize(base, base, cv::Size(base.cols * 2, base.rows * 2), 0., 0., cv::INTER_LINEAR);
+    const double base_diff(std::sqrt(std::max(sigma_ * sigma_ - 1., 0.01)));
+    cv::GaussianBlur(base, base, cv::Size(), base_diff, base_diff);
+
+    // incremental blurs between adjacent levels in an octave
+    std::vector< double > diffs(layers_ + 3);
+    for (int i = 1; i < layers_ + 3; ++i) {
+      const double prev(levelSigma(i - 1)), total(levelSigma(i));
+      diffs[i] = std::sqrt(total * total - prev * prev);
+    }
+
+    // the first level of an octave is the level of twice blur in the previous octave, decimated
+    const double min_side(std::min(base.cols, base.rows));
+    const int noctaves(std::max(cvRound(std::log(min_side) / std::log(2.) - 2.), 1));
+    levels_.resize(noctaves * (layers_ + 3));
+    for (int o = 0; o < noctaves; ++o) {
+      for (int i = 0; i < layers_ + 3; ++i) {
+        cv::Mat &dst(levels_[o * (layers_ + 3) + i]);
+        if (o == 0 && i == 0) {
+          dst = base;
+        } else if (i == 0) {
+          const cv::Mat &src(level(o - 1, layers_));
+          cv::resize(src, dst, cv::Size(src.cols / 2, src.rows / 2), 0., 0., cv::INTER_NEAREST);
+        } else {
+          cv::GaussianBlur(level(o, i - 1), dst, cv::Size(), diffs[i], diffs[i]);
+        }
+      }
+    }
+  }
+
+  int octaves() const { return levels_.size() / (layers_ + 3); }
+
+  int layers() const { return layers_; }
+
+  // the level of the octave (0 is the upsampled one) and the layer (0 to nOctaveLayers + 2)
+  const cv::Mat &level(const int octave, const int layer) const {
+    return levels_[octave * (layers_ + 3) + layer];
+  }
+
+  // the blur of the (possibly fractional) layer in pixels of its octave
+  double levelSigma(const double layer) const { return sigma_ * std::pow(2., layer / layers_); }
+
+private:
+  const int layers_;
+  const double sigma_;
+  std::vector< cv::Mat > levels_;
+};
+
+//
+// Determinant-of-Hessian keypoints (the criterion of SURF) and SIFT descriptors
+// on one Gaussian scale space. detectAndCompute() builds the scale space once
+// and hands it to both of the stages, where a SURF detector and a SIFT extractor
+// build an integral image and a Gaussian pyramid respectively.
+// Hessians are evaluated on the Gaussian levels instead of approximated with box filters,
+// so keypoints are not the same as ones of SURF. A response is sigma^4 * det(Hessian)
+// on 8-bit intensities, which is A^2 / 16 for a Gaussian blob of contrast A at its own scale
+// (i.e. the default detThreshold 100 keeps such blobs of contrast 40 or more).
+// Descriptors are the same as ones of SIFT except that the level for a keypoint
+// is chosen by its size.
+//
+
+class HessianSiftFeature : public cv::Feature2D {
+public:
+  // detThreshold: the minimum response of a keypoint
+  // upright: as SURF's (orientations are not computed if true)
+  // nfeatures, nOctaveLayers, sigma: as SIFT's
+  HessianSiftFeature(const double detThreshold = 100., const bool upright = false,
+                     const int nfeatures = 0, const int nOctaveLayers = 3,
+                     const double sigma = 1.6)
+      : det_threshold_(detThreshold), upright_(upright), nfeatures_(nfeatures),
+        layers_(nOctaveLayers), sigma_(sigma) {
+    CV_Assert(layers_ > 0 && sigma_ > 0.);
+  }
+
+  virtual ~HessianSiftFeature() {}
+
+  static cv::Ptr< HessianSiftFeature > create(const double detThreshold = 100.,
+                                              const bool upright = false, const int nfeatures = 0,
+                                              const int nOctaveLayers = 3,
+                                              const double sigma = 1.6) {
+    return new HessianSiftFeature(detThreshold, upright, nfeatures, nOctaveLayers, sigma);
+  }
+
+  //
+  // overloaded functions from cv::Feature2D
+  //
+
+  virtual void detectAndCompute(cv::InputArray src_image, cv::InputArray src_mask,
+                                std::vector< cv::KeyPoint > &keypoints,
+                                cv::OutputArray descriptors, bool useProvidedKeypoints) {
+    // the scale space shared by the detection and extraction
+    GaussianScaleSpace scale_space(layers_, sigma_);
+    scale_space.build(toGray(src_image.getMat()));
+
+    if (!useProvidedKeypoints) {
+      detectOn(scale_space, keypoints);
+      const cv::Mat mask(src_mask.getMat());
+      if (!mask.empty()) {
+        cv::KeyPointsFilter::runByPixelsMask(keypoints, mask);
+      }
+      cv::KeyPointsFilter::removeDuplicated(keypoints);
+      if (nfeatures_ > 0) {
+        cv::KeyPointsFilter::retainBest(keypoints, nfeatures_);
+      }
+    }
+
+    if (descriptors.needed()) {
+      descriptors.create(keypoints.size(), descriptorSize(), descriptorType());
+      cv::Mat descriptors_mat(descriptors.getMat());
+      computeOn(scale_space, keypoints, descriptors_mat);
+    }
+  }
+
+  virtual int descriptorSize() const { return DESCR_WIDTH * DESCR_WIDTH * DESCR_HIST_BINS; }
+
+  virtual int descriptorType() const { return CV_32F; }
+
+  virtual int defaultNorm() const { return cv::NORM_L2; }
+
+  virtual cv::String getDefaultName() const { return "HessianSiftFeature"; }
+
+private:
+  // constants of SIFT
+  enum {
+    DESCR_WIDTH = 4,
+    DESCR_HIST_BINS = 8,
+    ORI_HIST_BINS = 36,
+    IMG_BORDER = 5
+  };
+
+  static cv::Mat toGray(const cv::Mat &image) {
+    cv::Mat gray;
+    switch (image.channels()) {
+    case 3:
+      cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+      return gray;
+    case 4:
+      cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+      return gray;
+    default:
+      return image;
+    }
+  }
+
+  //
+  // detection
+  //
+
+  void detectOn(const GaussianScaleSpace &scale_space,
+                std::vector< cv::KeyPoint > &keypoints) const {
+    keypoints.clear();
+    const int nlayers(scale_space.layers());
+    for (int o = 0; o < scale_space.octaves(); ++o) {
+      // scale-normalized determinants of Hessians of levels used for extrema
+      std::vector< cv::Mat > dets(nlayers + 2);
+      for (int i = 0; i < nlayers + 2; ++i) {
+        hessianDeterminant(scale_space.level(o, i), scale_space.levelSigma(i), dets[i]);
+      }
+
+      for (int layer = 1; layer <= nlayers; ++layer) {
+        const cv::Mat &det(dets[layer]);
+        for (int r = IMG_BORDER; r < det.rows - IMG_BORDER; ++r) {
+          const float *const row(det.ptr< float >(r));
+          for (int c = IMG_BORDER; c < det.cols - IMG_BORDER; ++c) {
+            if (row[c] > det_threshold_ && isLocalMax(dets, layer, r, c)) {
+              addKeypoint(scale_space, dets, o, layer, r, c, keypoints);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  static void hessianDeterminant(const cv::Mat &level, const double sigma, cv::Mat &det) {
+    det = cv::Mat::zeros(level.size(), CV_32F);
+    const float norm(static_cast< float >(std::pow(sigma, 4.)));
+    for (int r = 1; r < level.rows - 1; ++r) {
+      const float *const prev(level.ptr< float >(r - 1));
+      const float *const curr(level.ptr< float >(r));
+      const float *const next(level.ptr< float >(r + 1));
+      float *const dst(det.ptr< float >(r));
+      for (int c = 1; c < level.cols - 1; ++c) {
+        const float dxx(curr[c + 1] + curr[c - 1] - 2.f * curr[c]);
+        const float dyy(next[c] + prev[c] - 2.f * curr[c]);
+        const float dxy((next[c + 1] - next[c - 1] - prev[c + 1] + prev[c - 1]) * 0.25f);
+        dst[c] = (dxx * dyy - dxy * dxy) * norm;
+      }
+    }
+  }
+
+  // true if the value is greater than all of its 26 neighbors in space and scale
+  static bool isLocalMax(const std::vector< cv::Mat > &dets, const int layer, const int r,
+                         const int c) {
+    const float val(dets[layer].at< float >(r, c));
+    for (int l = layer - 1; l <= layer + 1; ++l) {
+      for (int dr = -1; dr <= 1; ++dr) {
+        const float *const row(dets[l].ptr< float >(r + dr));
+        for (int dc = -1; dc <= 1; ++dc) {
+          if ((l != layer || dr != 0 || dc != 0) && row[c + dc] >= val) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // refine the extremum by fitting a quadratic, orient and append it
+  void addKeypoint(const GaussianScaleSpace &scale_space, const std::vector< cv::Mat > &dets,
+                   const int o, const int layer, const int r, const int c,
+                   std::vector< cv::KeyPoint > &keypoints) const {
+    const cv::Mat &prev(dets[layer - 1]), &curr(dets[layer]), &next(dets[layer + 1]);
+    const float val(curr.at< float >(r, c));
+    const cv::Vec3f grad((curr.at< float >(r, c + 1) - curr.at< float >(r, c - 1)) * 0.5f,
+                         (curr.at< float >(r + 1, c) - curr.at< float >(r - 1, c)) * 0.5f,
+                         (next.at< float >(r, c) - prev.at< float >(r, c)) * 0.5f);
+    const float dxx(curr.at< float >(r, c + 1) + curr.at< float >(r, c - 1) - 2.f * val);
+    const float dyy(curr.at< float >(r + 1, c) + curr.at< float >(r - 1, c) - 2.f * val);
+    const float dss(next.at< float >(r, c) + prev.at< float >(r, c) - 2.f * val);
+    const float dxy((curr.at< float >(r + 1, c + 1) - curr.at< float >(r + 1, c - 1) -
+                     curr.at< float >(r - 1, c + 1) + curr.at< float >(r - 1, c - 1)) *
+                    0.25f);
+    const float dxs((next.at< float >(r, c + 1) - next.at< float >(r, c - 1) -
+                     prev.at< float >(r, c + 1) + prev.at< float >(r, c - 1)) *
+                    0.25f);
+    const float dys((next.at< float >(r + 1, c) - next.at< float >(r - 1, c) -
+                     prev.at< float >(r + 1, c) + prev.at< float >(r - 1, c)) *
+                    0.25f);
+    const cv::Matx33f hessian(dxx, dxy, dxs, dxy, dyy, dys, dxs, dys, dss);
+    const cv::Vec3f offset(-(hessian.solve(grad, cv::DECOMP_LU)));
+
+    // reject the extremum if the fit is degenerate or moves out of the sample (as SURF)
+    for (int i = 0; i < 3; ++i) {
+      if (!(std::abs(offset[i]) < 1.f)) {
+        return;
+      }
+    }
+
+    // the keypoint in the source frame (the first octave is upsampled by 2)
+    const float scale((1 << o) * 0.5f);
+    cv::KeyPoint keypoint;
+    keypoint.pt = cv::Point2f((c + offset[0]) * scale, (r + offset[1]) * scale);
+    keypoint.size = 2.f * scale * scale_space.levelSigma(layer + offset[2]);
+    keypoint.response = val + 0.5f * grad.dot(offset);
+    keypoint.octave = ((o - 1) & 255) | (layer << 8) | (cvRound((offset[2] + 0.5f) * 255) << 16);
+
+    if (upright_) {
+      keypoint.angle = 0.f;
+      keypoints.push_back(keypoint);
+      return;
+    }
+
+    // one keypoint per peak of the orientation histogram (as SIFT)
+    const float scl(scale_space.levelSigma(layer + offset[2]));
+    float hist[ORI_HIST_BINS];
+    const float max_val(orientationHist(scale_space.level(o, layer), cv::Point(c, r),
+                                        cvRound(4.5f * scl), 1.5f * scl, hist));
+    for (int j = 0; j < ORI_HIST_BINS; ++j) {
+      const int left(j > 0 ? j - 1 : ORI_HIST_BINS - 1);
+      const int right(j < ORI_HIST_BINS - 1 ? j + 1 : 0);
+      if (hist[j] > hist[left] && hist[j] > hist[right] && hist[j] >= 0.8f * max_val) {
+        float bin(j + 0.5f * (hist[left] - hist[right]) /
+                          (hist[left] - 2.f * hist[j] + hist[right]));
+        bin = bin < 0.f ? ORI_HIST_BINS + bin : bin >= ORI_HIST_BINS ? bin - ORI_HIST_BINS : bin;
+        keypoint.angle = 360.f - 360.f / ORI_HIST_BINS * bin;
+        if (std::abs(keypoint.angle - 360.f) < FLT_EPSILON) {
+          keypoint.angle = 0.f;
+        }
+        keypoints.push_back(keypoint);
+      }
+    }
+  }
+
+  // the smoothed histogram of gradient orientations around the point. returns the max bin.
+  // (a port of calcOrientationHist() in opencv_contrib. see the notice at the top of this file)
+  static float orientationHist(const cv::Mat &level, const cv::Point &pt, const int radius,
+                               const float sigma, float *hist) {
+    const float exp_scale(-1.f / (2.f * sigma * sigma));
+    float raw[ORI_HIST_BINS + 4] = {0.f};
+    float *const bins(raw + 2);
+    for (int i = -radius; i <= radius; ++i) {
+      const int y(pt.y + i);
+      if (y <= 0 || y >= level.rows - 1) {
+        continue;
+      }
+      for (int j = -radius; j <= radius; ++j) {
+        const int x(pt.x + j);
+        if (x <= 0 || x >= level.cols - 1) {
+          continue;
+        }
+        const float dx(level.at< float >(y, x + 1) - level.at< float >(y, x - 1));
+        const float dy(level.at< float >(y - 1, x) - level.at< float >(y + 1, x));
+        const float weight(std::exp((i * i + j * j) * exp_scale));
+        int bin(cvRound(ORI_HIST_BINS / 360.f * cv::fastAtan2(dy, dx)));
+        bin = bin >= ORI_HIST_BINS ? bin - ORI_HIST_BINS : bin < 0 ? bin + ORI_HIST_BINS : bin;
+        bins[bin] += weight * std::sqrt(dx * dx + dy * dy);
+      }
+    }
+
+    // smooth the circular histogram
+    bins[-1] = bins[ORI_HIST_BINS - 1];
+    bins[-2] = bins[ORI_HIST_BINS - 2];
+    bins[ORI_HIST_BINS] = bins[0];
+    bins[ORI_HIST_BINS + 1] = bins[1];
+    float max_val(0.f);
+    for (int i = 0; i < ORI_HIST_BINS; ++i) {
+      hist[i] = (bins[i - 2] + bins[i + 2]) * (1.f / 16.f) +
+                (bins[i - 1] + bins[i + 1]) * (4.f / 16.f) + bins[i] * (6.f / 16.f);
+      max_val = std::max(max_val, hist[i]);
+    }
+    return max_val;
+  }
+
+  //
+  // extraction
+  //
+
+  static void computeOn(const GaussianScaleSpace &scale_space,
+                      const std::vector< cv::KeyPoint > &keypoints, cv::Mat &descriptors) {
+    const int nlayers(scale_space.layers());
+    for (std::size_t i = 0; i < keypoints.size(); ++i) {
+      const cv::KeyPoint &keypoint(keypoints[i]);
+      float *const dst(descriptors.ptr< float >(i));
+      if (scale_space.octaves() == 0) {
+        std::fill(dst, dst + descriptors.cols, 0.f);
+        continue;
+      }
+
+      // the level whose blur is the nearest to the scale of the keypoint
+      // (keypoint.size / 2 in the source frame, keypoint.size in the first octave)
+      const double t(std::log(std::max(keypoint.size, FLT_EPSILON) / scale_space.levelSigma(0)) /
+                     std::log(2.));
+      int o(cvFloor(t)), layer(cvRound((t - o) * nlayers));
+      if (o < 0) {
+        o = 0;
+        layer = 0;
+      } else if (o >= scale_space.octaves()) {
+        o = scale_space.octaves() - 1;
+        layer = nlayers + 2;
+      }
+
+      const float scale(2.f / (1 << o));
+      float angle(keypoint.angle < 0.f ? 0.f : 360.f - keypoint.angle);
+      if (std::abs(angle - 360.f) < FLT_EPSILON) {
+        angle = 0.f;
+      }
+      siftDescriptor(scale_space.level(o, layer), keypoint.pt * scale, angle,
+                     keypoint.size * scale * 0.5f, dst);
+    }
+  }
+
+  // the SIFT descriptor on the level
+  // (a port of calcSIFTDescriptor() in opencv_contrib. see the notice at the top of this file)
+  static void siftDescriptor(const cv::Mat &level, const cv::Point2f &ptf, const float ori,
+                             const float scl, float *dst) {
+    const int d(DESCR_WIDTH), n(DESCR_HIST_BINS);
+    const cv::Point pt(cvRound(ptf.x), cvRound(ptf.y));
+    const float bins_per_deg(n / 360.f);
+    const float exp_scale(-1.f / (d * d * 0.5f));
+    const float hist_width(3.f * scl);
+    const int radius(std::min(cvRound(hist_width * 1.4142135623730951f * (d + 1) * 0.5f),
+                              static_cast< int >(std::sqrt(static_cast< double >(level.cols) *
+                                                               level.cols +
+                                                           static_cast< double >(level.rows) *
+                                                               level.rows))));
+    const float cos_t(std::cos(ori * static_cast< float >(CV_PI / 180.)) / hist_width);
+    const float sin_t(std::sin(ori * static_cast< float >(CV_PI / 180.)) / hist_width);
+
+    // histograms with margins for the tri-linear interpolation
+    std::vector< float > hist((d + 2) * (d + 2) * (n + 2), 0.f);
+    for (int i = -radius; i <= radius; ++i) {
+      for (int j = -radius; j <= radius; ++j) {
+        // coordinates in the histogram array rotated relative to the orientation
+        const float c_rot(j * cos_t - i * sin_t);
+        const float r_rot(j * sin_t + i * cos_t);
+        float rbin(r_rot + d / 2 - 0.5f);
+        float cbin(c_rot + d / 2 - 0.5f);
+        const int r(pt.y + i), c(pt.x + j);
+        if (!(rbin > -1.f && rbin < d && cbin > -1.f && cbin < d && r > 0 && r < level.rows - 1 &&
+              c > 0 && c < level.cols - 1)) {
+          continue;
+        }
+
+        const float dx(level.at< float >(r, c + 1) - level.at< float >(r, c - 1));
+        const float dy(level.at< float >(r - 1, c) - level.at< float >(r + 1, c));
+        const float mag(std::sqrt(dx * dx + dy * dy) *
+                        std::exp((c_rot * c_rot + r_rot * r_rot) * exp_scale));
+        float obin((cv::fastAtan2(dy, dx) - ori) * bins_per_deg);
+        const int r0(cvFloor(rbin)), c0(cvFloor(cbin));
+        int o0(cvFloor(obin));
+        rbin -= r0;
+        cbin -= c0;
+        obin -= o0;
+        o0 = o0 < 0 ? o0 + n : o0 >= n ? o0 - n : o0;
+
+        // distribute the magnitude to the 8 neighboring bins
+        const float v_r1(mag * rbin), v_r0(mag - v_r1);
+        const float v_rc11(v_r1 * cbin), v_rc10(v_r1 - v_rc11);
+        const float v_rc01(v_r0 * cbin), v_rc00(v_r0 - v_rc01);
+        const int idx(((r0 + 1) * (d + 2) + c0 + 1) * (n + 2) + o0);
+        hist[idx] += v_rc00 * (1.f - obin);
+        hist[idx + 1] += v_rc00 * obin;
+        hist[idx + (n + 2)] += v_rc01 * (1.f - obin);
+        hist[idx + (n + 3)] += v_rc01 * obin;
+        hist[idx + (d + 2) * (n + 2)] += v_rc10 * (1.f - obin);
+        hist[idx + (d + 2) * (n + 2) + 1] += v_rc10 * obin;
+        hist[idx + (d + 3) * (n + 2)] += v_rc11 * (1.f - obin);
+        hist[idx + (d + 3) * (n + 2) + 1] += v_rc11 * obin;
+      }
+    }
+
+    // wrap the circular orientation histograms and copy them to the descriptor
+    for (int i = 0; i < d; ++i) {
+      for (int j = 0; j < d; ++j) {
+        const int idx(((i + 1) * (d + 2) + (j + 1)) * (n + 2));
+        hist[idx] += hist[idx + n];
+        hist[idx + 1] += hist[idx + n + 1];
+        std::copy(hist.begin() + idx, hist.begin() + idx + n, dst + (i * d + j) * n);
+      }
+    }
+
+    // clip large bins, normalize and scale the descriptor as SIFT
+    const int len(d * d * n);
+    float nrm2(0.f);
+    for (int k = 0; k < len; ++k) {
+      nrm2 += dst[k] * dst[k];
+    }
+    const float thr(std::sqrt(nrm2) * 0.2f);
+    nrm2 = 0.f;
+    for (int k = 0; k < len; ++k) {
+      dst[k] = std::min(dst[k], thr);
+      nrm2 += dst[k] * dst[k];
+    }
+    const float factor(512.f / std::max(std::sqrt(nrm2), FLT_EPSILON));
+    for (int k = 0; k < len; ++k) {
+      dst[k] = cv::saturate_cast< uchar >(dst[k] * factor);
+    }
+  }
+
+private:
+  const double det_threshold_;
+  const bool upright_;
+  const int nfeatures_;
+  const int layers_;
+  const double sigma_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef AFFINE_INVARIANT_FEATURES_KEYPOINT_GRID
+#define AFFINE_INVARIANT_FEATURES_KEYPOINT_GRID
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A uniform grid over keypoint positions to find keypoints in a neighborhood.
+// Indices of keypoints are bucketed by cells in a compressed row storage
+// (indices of the cell i are indices_[starts_[i]] to indices_[starts_[i + 1] - 1]).
+// Keypoints at non-finite positions are not indexed and never found.
+//
+
+class KeypointGrid {
+public:
+  KeypointGrid() : cell_size_(1.f), cols_(0), rows_(0) {}
+
+  // cell_size <= 0 means that the cell size is chosen
+  // so that each cell has about 4 keypoints on average
+  KeypointGrid(const std::vector< cv::KeyPoint > &keypoints, const float cell_size = 0.f) {
+    build(keypoints, cell_size);
+  }
+
+  virtual ~KeypointGrid() {}
+
+  void build(const std::vector< cv::KeyPoint > &keypoints, const float cell_size = 0.f) {
+    points_.clear();
+    starts_.clear();
+    indices_.clear();
+    cols_ = rows_ = 0;
+    cell_size_ = 1.f;
+
+    // bounding box of the keypoints
+    std::size_t nfinite(0);
+    cv::Point2f tl, br;
+    for (std::vector< cv::KeyPoint >::const_iterator kp = keypoints.begin(); kp != keypoints.end();
+         ++kp) {
+      points_.push_back(kp->pt);
+      if (!isFinite(kp->pt)) {
+        continue;
+      }
+      if (nfinite++ == 0) {
+        tl = br = kp->pt;
+        continue;
+      }
+      tl.x = std::min(tl.x, kp->pt.x);
+      tl.y = std::min(tl.y, kp->pt.y);
+      br.x = std::max(br.x, kp->pt.x);
+      br.y = std::max(br.y, kp->pt.y);
+    }
+    if (nfinite == 0) {
+      return;
+    }
+    origin_ = tl;
+    extent_ = br - tl;
+    cell_size_ = cell_size > 0.f
+                     ? cell_size
+                     : std::max(std::sqrt(4.f * extent_.x * extent_.y / nfinite), 1.f);
+    cols_ = static_cast< int >(extent_.x / cell_size_) + 1;
+    rows_ = static_cast< int >(extent_.y / cell_size_) + 1;
+
+    // count keypoints in each cell, and then fill indices by counting sort
+    starts_.assign(cols_ * rows_ + 1, 0);
+    std::vector< int > cells(points_.size(), -1);
+    for (std::size_t i = 0; i < points_.size(); ++i) {
+      if (isFinite(points_[i])) {
+        cells[i] = cellOf(points_[i]);
+        ++starts_[cells[i] + 1];
+      }
+    }
+    for (std::size_t i = 1; i < starts_.size(); ++i) {
+      starts_[i] += starts_[i - 1];
+    }
+    indices_.resize(nfinite);
+    std::vector< int > fills(starts_.begin(), starts_.end() - 1);
+    for (std::size_t i = 0; i < points_.size(); ++i) {
+      if (cells[i] >= 0) {
+        indices_[fills[cells[i]]++] = i;
+      }
+    }
+  }
+
+  bool empty() const { return indices_.empty(); }
+
+  // number of indexed keypoints
+  std::size_t size() const { return indices_.size(); }
+
+  // indices of keypoints within the radius from the center.
+  // no keypoints are found for a non-finite center or radius (e.g. a point projected to infinity).
+  void radiusSearch(const cv::Point2f &center, const float radius,
+                    std::vector< int > &indices) const {
+    indices.clear();
+    if (indices_.empty() || !isFinite(center) || !isFinite(radius) || radius < 0.f) {
+      return;
+    }
+
+    // no keypoints if the circle is out of the bounding box
+    if (center.x + radius < origin_.x || center.x - radius > origin_.x + extent_.x ||
+        center.y + radius < origin_.y || center.y - radius > origin_.y + extent_.y) {
+      return;
+    }
+
+    // range of cells overlapping the circle
+    const int col_min(std::max(toCol(center.x - radius), 0));
+    const int col_max(std::min(toCol(center.x + radius), cols_ - 1));
+    const int row_min(std::max(toRow(center.y - radius), 0));
+    const int row_max(std::min(toRow(center.y + radius), rows_ - 1));
+
+    const float sq_radius(radius * radius);
+    for (int row = row_min; row <= row_max; ++row) {
+      for (int col = col_min; col <= col_max; ++col) {
+        const int cell(row * cols_ + col);
+        for (int i = starts_[cell]; i < starts_[cell + 1]; ++i) {
+          const cv::Point2f d(points_[indices_[i]] - center);
+          if (d.x * d.x + d.y * d.y <= sq_radius) {
+            indices.push_back(indices_[i]);
+          }
+        }
+      }
+    }
+  }
+
+  // indices of keypoints inside the rectangle (the right and bottom edges are excluded)
+  void rectSearch(const cv::Rect2f &rect, std::vector< int > &indices) const {
+    indices.clear();
+    if (indices_.empty() || !isFinite(rect.tl()) || !isFinite(rect.br())) {
+      return;
+    }
+
+    // no keypoints if the rectangle is out of the bounding box
+    if (rect.x + rect.width < origin_.x || rect.x > origin_.x + extent_.x ||
+        rect.y + rect.height < origin_.y || rect.y > origin_.y + extent_.y) {
+      return;
+    }
+
+    // range of cells overlapping the rectangle
+    const int col_min(std::max(toCol(rect.x), 0));
+    const int col_max(std::min(toCol(rect.x + rect.width), cols_ - 1));
+    const int row_min(std::max(toRow(rect.y), 0));
+    const int row_max(std::min(toRow(rect.y + rect.height), rows_ - 1));
+
+    for (int row = row_min; row <= row_max; ++row) {
+      for (int col = col_min; col <= col_max; ++col) {
+        const int cell(row * cols_ + col);
+        for (int i = starts_[cell]; i < starts_[cell + 1]; ++i) {
+          if (rect.contains(points_[indices_[i]])) {
+            indices.push_back(indices_[i]);
+          }
+        }
+      }
+    }
+  }
+
+private:
+  static bool isFinite(const float v) { return !cvIsNaN(v) && !cvIsInf(v); }
+
+  static bool isFinite(const cv::Point2f &pt) { return isFinite(pt.x) && isFinite(pt.y); }
+
+  // cell indices are clamped in floating point before the conversion,
+  // which is undefined for values out of the range of int
+  static int toCell(const float v, const int ncells) {
+    return static_cast< int >(std::min(std::max(std::floor(v), -1.f), float(ncells)));
+  }
+
+  int toCol(const float x) const { return toCell((x - origin_.x) / cell_size_, cols_); }
+
+  int toRow(const float y) const { return toCell((y - origin_.y) / cell_size_, rows_); }
+
+  int cellOf(const cv::Point2f &pt) const {
+    return std::min(std::max(toRow(pt.y), 0), rows_ - 1) * cols_ +
+           std::min(std::max(toCol(pt.x), 0), cols_ - 1);
+  }
+
+private:
+  std::vector< cv::Point2f > points_;
+  cv::Point2f origin_, extent_; // top-left and size of the bounding box
+  float cell_size_;
+  int cols_, rows_;
+  std::vector< int > starts_;
+  std::vector< int > indices_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef AFFINE_INVARIANT_FEATURES_L2_MATCHERS
+#define AFFINE_INVARIANT_FEATURES_L2_MATCHERS
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/parallel_tasks.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Exact k-nearest neighbor search for descriptors in L2 distance.
+// Squared distances between a block of queries and a block of train descriptors
+// are computed at once as ||q||^2 + ||t||^2 - 2 q.t where the last term is a matrix product
+// by cv::gemm(), which is backed by an optimized BLAS if OpenCV is built with it.
+// Then the k nearest neighbors of each query are selected while scanning the distance block.
+//
+
+class BlockedL2Matcher : public cv::DescriptorMatcher {
+public:
+  // queryBlockSize, trainBlockSize: the number of rows of query and train descriptors
+  // in a distance block. the default makes a block of 1MB.
+  BlockedL2Matcher(const int queryBlockSize = 256, const int trainBlockSize = 1024)
+      : query_block_size_(queryBlockSize), train_block_size_(trainBlockSize), trained_(false) {
+    CV_Assert(query_block_size_ > 0 && train_block_size_ > 0);
+  }
+
+  virtual ~BlockedL2Matcher() {}
+
+  //
+  // overloaded functions from cv::DescriptorMatcher
+  //
+
+  virtual void add(cv::InputArrayOfArrays descriptors) {
+    cv::DescriptorMatcher::add(descriptors);
+    trained_ = false;
+  }
+
+  virtual void clear() {
+    cv::DescriptorMatcher::clear();
+    merged_ = cv::Mat();
+    norms_ = cv::Mat();
+    offsets_.clear();
+    trained_ = false;
+  }
+
+  virtual bool isMaskSupported() const { return false; }
+
+  virtual void train() {
+    if (trained_) {
+      return;
+    }
+
+    // merge all train descriptors into one float matrix
+    offsets_.clear();
+    int nrows(0);
+    for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+      CV_Assert(trainDescCollection[i].channels() == 1);
+      offsets_.push_back(nrows);
+      nrows += trainDescCollection[i].rows;
+    }
+    if (trainDescCollection.size() == 1) {
+      merged_ = trainDescCollection[0];
+    } else if (!trainDescCollection.empty()) {
+      cv::vconcat(trainDescCollection, merged_);
+    }
+    if (merged_.type() != CV_32FC1) {
+      merged_.convertTo(merged_, CV_32F);
+    }
+
+    // squared norms of train descriptors as a row vector
+    squaredNorms(merged_, norms_);
+    norms_ = norms_.reshape(1, 1);
+
+    trained_ = true;
+  }
+
+  virtual cv::Ptr< cv::DescriptorMatcher > clone(bool emptyTrainData = false) const {
+    cv::Ptr< BlockedL2Matcher > matcher(new BlockedL2Matcher(query_block_size_, train_block_size_));
+    if (!emptyTrainData) {
+      for (std::size_t i = 0; i < trainDescCollection.size(); ++i) {
+        matcher->add(trainDescCollection[i].clone());
+      }
+    }
+    return matcher;
+  }
+
+protected:
+  // (squared distance, row in the merged descriptors)
+  typedef std::pair< float, int > Neighbor;
+
+  virtual void knnMatchImpl(cv::InputArray queryDescriptors,
+                            std::vector< std::vector< cv::DMatch > > &matches, int k,
+                            cv::InputArrayOfArrays /* masks */, bool compactResult) {
+    search(queryDescriptors.getMat(), k, -1.f, matches, compactResult);
+  }
+
+  virtual void radiusMatchImpl(cv::InputArray queryDescriptors,
+                               std::vector< std::vector< cv::DMatch > > &matches, float maxDistance,
+                               cv::InputArrayOfArrays /* masks */, bool compactResult) {
+    search(queryDescriptors.getMat(), 0, maxDistance, matches, compactResult);
+  }
+
+  // k nearest neighbors if max_distance < 0. otherwise all neighbors within max_distance.
+  void search(const cv::Mat &src_query, const int k, const float max_distance,
+              std::vector< std::vector< cv::DMatch > > &matches, const bool compactResult) const {
+    CV_Assert(src_query.channels() == 1 && src_query.cols == merged_.cols);
+
+    // integer descriptors (e.g. quantized ones) are matched as float
+    cv::Mat query(src_query);
+    if (query.type() != CV_32FC1) {
+      src_query.convertTo(query, CV_32F);
+    }
+
+    // search neighbors of each query block in parallel
+    std::vector< std::vector< Neighbor > > neighbors(query.rows);
+    const int nblocks((query.rows + query_block_size_ - 1) / query_block_size_);
+    ParallelTasks tasks(nblocks);
+    for (int i = 0; i < nblocks; ++i) {
+      const cv::Range rows(i * query_block_size_,
+                           std::min((i + 1) * query_block_size_, query.rows));
+      tasks[i] = boost::bind(&BlockedL2Matcher::searchBlock, this, boost::cref(query), rows, k,
+                             max_distance, boost::ref(neighbors));
+    }
+    cv::parallel_for_(cv::Range(0, nblocks), tasks);
+
+    // convert neighbors to matches
+    matches.clear();
+    matches.reserve(query.rows);
+    for (int i = 0; i < query.rows; ++i) {
+      if (compactResult && neighbors[i].empty()) {
+        continue;
+      }
+      matches.push_back(std::vector< cv::DMatch >());
+      for (std::vector< Neighbor >::const_iterator n = neighbors[i].begin();
+           n != neighbors[i].end(); ++n) {
+        matches.back().push_back(toDMatch(i, *n));
+      }
+    }
+  }
+
+  void searchBlock(const cv::Mat &query, const cv::Range &query_rows, const int k,
+                   const float max_distance,
+                   std::vector< std::vector< Neighbor > > &neighbors) const {
+    const cv::Mat query_block(query.rowRange(query_rows));
+    cv::Mat query_norms;
+    squaredNorms(query_block, query_norms);
+
+    const float max_sq_distance(max_distance * max_distance);
+    cv::Mat dists;
+    for (int begin = 0; begin < merged_.rows; begin += train_block_size_) {
+      const cv::Range train_rows(begin, std::min(begin + train_block_size_, merged_.rows));
+
+      // -2 q.t for all pairs in the block
+      cv::gemm(query_block, merged_.rowRange(train_rows), -2., cv::noArray(), 0., dists,
+               cv::GEMM_2_T);
+
+      // add squared norms and select neighbors
+      const float *const train_norms(norms_.ptr< float >() + train_rows.start);
+      for (int i = 0; i < dists.rows; ++i) {
+        const float query_norm(query_norms.at< float >(i));
+        const float *const row(dists.ptr< float >(i));
+        std::vector< Neighbor > &row_neighbors(neighbors[query_rows.start + i]);
+        if (max_distance < 0.f) {
+          selectNearest(row, train_norms, query_norm, dists.cols, train_rows.start, k,
+                        row_neighbors);
+        } else {
+          for (int j = 0; j < dists.cols; ++j) {
+            const float dist(std::max(row[j] + train_norms[j] + query_norm, 0.f));
+            if (dist <= max_sq_distance) {
+              row_neighbors.push_back(Neighbor(dist, train_rows.start + j));
+            }
+          }
+        }
+      }
+    }
+
+    if (max_distance >= 0.f) {
+      for (int i = query_rows.start; i < query_rows.end; ++i) {
+        std::sort(neighbors[i].begin(), neighbors[i].end());
+      }
+    }
+  }
+
+  // update the sorted list of the k nearest neighbors with a row of the distance block.
+  // k = 2, which is used for the ratio test, is fused into a single scan with two registers.
+  static void selectNearest(const float *row, const float *train_norms, const float query_norm,
+                            const int ncols, const int offset, const int k,
+                            std::vector< Neighbor > &neighbors) {
+    if (k == 2) {
+      Neighbor first(neighbors.size() > 0 ? neighbors[0] : Neighbor(FLT_MAX, -1));
+      Neighbor second(neighbors.size() > 1 ? neighbors[1] : Neighbor(FLT_MAX, -1));
+      for (int j = 0; j < ncols; ++j) {
+        const float dist(std::max(row[j] + train_norms[j] + query_norm, 0.f));
+        if (dist < second.first) {
+          if (dist < first.first) {
+            second = first;
+            first = Neighbor(dist, offset + j);
+          } else {
+            second = Neighbor(dist, offset + j);
+          }
+        }
+      }
+      neighbors.clear();
+      if (first.second >= 0) {
+        neighbors.push_back(first);
+      }
+      if (second.second >= 0) {
+        neighbors.push_back(second);
+      }
+    } else {
+      for (int j = 0; j < ncols; ++j) {
+        const Neighbor neighbor(std::max(row[j] + train_norms[j] + query_norm, 0.f), offset + j);
+        if (neighbors.size() >= static_cast< std::size_t >(k) && !(neighbor < neighbors.back())) {
+          continue;
+        }
+        neighbors.insert(std::upper_bound(neighbors.begin(), neighbors.end(), neighbor),
+                         neighbor);
+        if (neighbors.size() > static_cast< std::size_t >(k)) {
+          neighbors.pop_back();
+        }
+      }
+    }
+  }
+
+  // squared L2 norms of rows as a column vector
+  static void squaredNorms(const cv::Mat &src, cv::Mat &dst) {
+    if (src.empty()) {
+      dst = cv::Mat::zeros(0, 1, CV_32FC1);
+      return;
+    }
+    cv::reduce(src.mul(src), dst, 1, cv::REDUCE_SUM, CV_32F);
+  }
+
+  cv::DMatch toDMatch(const int query_idx, const Neighbor &neighbor) const {
+    // find which train descriptors the merged row belongs to
+    const int img_idx(std::upper_bound(offsets_.begin(), offsets_.end(), neighbor.second) -
+                      offsets_.begin() - 1);
+    return cv::DMatch(query_idx, neighbor.second - offsets_[img_idx], img_idx,
+                      std::sqrt(neighbor.first));
+  }
+
+protected:
+  const int query_block_size_;
+  const int train_block_size_;
+  cv::Mat merged_;
+  cv::Mat norms_; // squared norms of merged_ as a row vector
+  std::vector< int > offsets_;
+  bool trained_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
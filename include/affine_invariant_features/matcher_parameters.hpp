@@ -0,0 +1,393 @@
+#ifndef AFFINE_INVARIANT_FEATURES_MATCHER_PARAMETERS
+#define AFFINE_INVARIANT_FEATURES_MATCHER_PARAMETERS
+
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/blocked_descriptors.hpp>
+#include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/hamming_matchers.hpp>
+#include <affine_invariant_features/l2_matchers.hpp>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/flann.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A base class for parameter sets of descriptor matchers used in ResultMatcher
+//
+
+struct MatcherParameters : public CvSerializable {
+public:
+  MatcherParameters() {}
+
+  virtual ~MatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const = 0;
+
+  // whether the matcher can match descriptors of the norm type (of references).
+  // ResultMatcher refuses a reference whose norm type is not supported.
+  virtual bool supportsNormType(const int /* normType */) const { return true; }
+};
+
+//
+// Descriptor matcher and thresholds of ResultMatcher
+//
+
+template <> cv::Ptr< MatcherParameters > load< MatcherParameters >(const cv::FileNode &fn);
+
+struct ResultMatcherParameters : public MatcherParameters {
+public:
+  ResultMatcherParameters()
+      : ratioThreshold(0.75), estimator(cv::RANSAC), reprojectionThreshold(5.), maxIters(2000),
+        confidence(0.995), minMatches(4), verificationSamples(0), polishIters(0) {}
+
+  virtual ~ResultMatcherParameters() {}
+
+  // return an empty pointer if no matcher is specified.
+  // then ResultMatcher will choose the default matcher for the reference.
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return matcher ? matcher->createMatcher() : cv::Ptr< cv::DescriptorMatcher >();
+  }
+
+  // the default matcher supports any norm type
+  virtual bool supportsNormType(const int normType) const {
+    return matcher ? matcher->supportsNormType(normType) : true;
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    matcher = load< MatcherParameters >(fn);
+    // missing keys fall back to the defaults so that partial files are usable
+    cv::read(fn["ratioThreshold"], ratioThreshold, 0.75);
+    cv::read(fn["estimator"], estimator, cv::RANSAC);
+    cv::read(fn["reprojectionThreshold"], reprojectionThreshold, 5.);
+    cv::read(fn["maxIters"], maxIters, 2000);
+    cv::read(fn["confidence"], confidence, 0.995);
+    cv::read(fn["minMatches"], minMatches, 4);
+    cv::read(fn["verificationSamples"], verificationSamples, 0);
+    cv::read(fn["polishIters"], polishIters, 0);
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    if (matcher) {
+      matcher->save(fs);
+    }
+    fs << "ratioThreshold" << ratioThreshold;
+    fs << "estimator" << estimator;
+    fs << "reprojectionThreshold" << reprojectionThreshold;
+    fs << "maxIters" << maxIters;
+    fs << "confidence" << confidence;
+    fs << "minMatches" << minMatches;
+    fs << "verificationSamples" << verificationSamples;
+    fs << "polishIters" << polishIters;
+  }
+
+  virtual std::string getDefaultName() const { return "ResultMatcherParameters"; }
+
+public:
+  cv::Ptr< MatcherParameters > matcher;
+  // a match is unique if its distance < ratioThreshold * distance of the 2nd match
+  double ratioThreshold;
+  // parameters of cv::findHomography().
+  // estimator is one of cv::RANSAC (8), cv::LMEDS (4) or cv::RHO (16).
+  int estimator;
+  double reprojectionThreshold;
+  int maxIters;
+  double confidence;
+  // the minimum number of matches to accept a registration (4 at least for a homography)
+  int minMatches;
+  // if > 0 and there are more unique matches, a transform is first estimated
+  // on this number of matches sampled uniformly over the source image,
+  // and then scored and polished on all matches. 0 means that all matches are used.
+  // ignored for LMEDS, which has no fixed threshold to score all matches with.
+  int verificationSamples;
+  // the maximum number of least-squares refinements on inliers of all matches
+  // (0 disables refinement). ignored for LMEDS for the same reason as verificationSamples.
+  int polishIters;
+};
+
+//
+// Brute force matching (accepts any descriptors including quantized ones)
+//
+
+struct BFMatcherParameters : public MatcherParameters {
+public:
+  BFMatcherParameters() : normType(cv::NORM_L2) {}
+
+  virtual ~BFMatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new cv::BFMatcher(normType);
+  }
+
+  virtual void read(const cv::FileNode &fn) { fn["normType"] >> normType; }
+
+  virtual void write(cv::FileStorage &fs) const { fs << "normType" << normType; }
+
+  virtual std::string getDefaultName() const { return "BFMatcherParameters"; }
+
+public:
+  int normType; // cv::NormTypes
+};
+
+//
+// FLANN randomized kd-trees for float descriptors
+//
+
+struct KDTreeMatcherParameters : public MatcherParameters {
+public:
+  KDTreeMatcherParameters() : trees(4), checks(32) {}
+
+  virtual ~KDTreeMatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new cv::FlannBasedMatcher(new cv::flann::KDTreeIndexParams(trees),
+                                     new cv::flann::SearchParams(checks));
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["trees"] >> trees;
+    fn["checks"] >> checks;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "trees" << trees;
+    fs << "checks" << checks;
+  }
+
+  virtual std::string getDefaultName() const { return "KDTreeMatcherParameters"; }
+
+public:
+  int trees;
+  int checks;
+};
+
+//
+// Exact blocked search for float descriptors (and quantized ones). see also the section below.
+//
+
+struct BlockedL2MatcherParameters : public MatcherParameters {
+public:
+  BlockedL2MatcherParameters() : queryBlockSize(256), trainBlockSize(1024) {}
+
+  virtual ~BlockedL2MatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new BlockedL2Matcher(queryBlockSize, trainBlockSize);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["queryBlockSize"] >> queryBlockSize;
+    fn["trainBlockSize"] >> trainBlockSize;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "queryBlockSize" << queryBlockSize;
+    fs << "trainBlockSize" << trainBlockSize;
+  }
+
+  virtual bool supportsNormType(const int normType) const { return normType == cv::NORM_L2; }
+
+  virtual std::string getDefaultName() const { return "BlockedL2MatcherParameters"; }
+
+public:
+  int queryBlockSize;
+  int trainBlockSize;
+};
+
+//
+// Exact brute force search for binary descriptors in the blocked layout.
+// The norm is always Hamming, which the reference must have.
+// Use BlockedL2MatcherParameters for float descriptors.
+//
+
+struct BlockedLayoutMatcherParameters : public MatcherParameters {
+public:
+  BlockedLayoutMatcherParameters() : queryBlockSize(64) {}
+
+  virtual ~BlockedLayoutMatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new BlockedDescriptorMatcher(queryBlockSize);
+  }
+
+  virtual bool supportsNormType(const int normType) const {
+    return normType == cv::NORM_HAMMING;
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    // files written when this also took float descriptors may have the norm type
+    int normType;
+    cv::read(fn["normType"], normType, cv::NORM_HAMMING);
+    if (normType != cv::NORM_HAMMING) {
+      CV_Error(cv::Error::StsBadArg, "BlockedLayoutMatcherParameters is for binary descriptors. "
+                                     "Use BlockedL2MatcherParameters for float descriptors.");
+    }
+    fn["queryBlockSize"] >> queryBlockSize;
+  }
+
+  virtual void write(cv::FileStorage &fs) const { fs << "queryBlockSize" << queryBlockSize; }
+
+  virtual std::string getDefaultName() const { return "BlockedLayoutMatcherParameters"; }
+
+public:
+  int queryBlockSize;
+};
+
+//
+// FLANN locality sensitive hashing for binary descriptors
+//
+
+struct LshMatcherParameters : public MatcherParameters {
+public:
+  LshMatcherParameters() : tableNumber(6), keySize(12), multiProbeLevel(1), checks(32) {}
+
+  virtual ~LshMatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new cv::FlannBasedMatcher(
+        new cv::flann::LshIndexParams(tableNumber, keySize, multiProbeLevel),
+        new cv::flann::SearchParams(checks));
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["tableNumber"] >> tableNumber;
+    fn["keySize"] >> keySize;
+    fn["multiProbeLevel"] >> multiProbeLevel;
+    fn["checks"] >> checks;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "tableNumber" << tableNumber;
+    fs << "keySize" << keySize;
+    fs << "multiProbeLevel" << multiProbeLevel;
+    fs << "checks" << checks;
+  }
+
+  virtual std::string getDefaultName() const { return "LshMatcherParameters"; }
+
+public:
+  int tableNumber;
+  int keySize;
+  int multiProbeLevel;
+  int checks;
+};
+
+//
+// Multi-index hashing for binary descriptors
+//
+
+struct MIHMatcherParameters : public MatcherParameters {
+public:
+  MIHMatcherParameters() : substringBytes(2), maxRadius(-1), maxChecks(0) {}
+
+  virtual ~MIHMatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new MultiIndexHashingMatcher(substringBytes, maxRadius, maxChecks);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["substringBytes"] >> substringBytes;
+    fn["maxRadius"] >> maxRadius;
+    fn["maxChecks"] >> maxChecks;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "substringBytes" << substringBytes;
+    fs << "maxRadius" << maxRadius;
+    fs << "maxChecks" << maxChecks;
+  }
+
+  virtual std::string getDefaultName() const { return "MIHMatcherParameters"; }
+
+public:
+  int substringBytes;
+  int maxRadius; // negative for exact search
+  int maxChecks; // 0 for unlimited
+};
+
+//
+// Hierarchical navigable small world graph for binary descriptors
+//
+
+struct HNSWMatcherParameters : public MatcherParameters {
+public:
+  HNSWMatcherParameters() : M(16), efConstruction(100), efSearch(64), seed(0) {}
+
+  virtual ~HNSWMatcherParameters() {}
+
+  virtual cv::Ptr< cv::DescriptorMatcher > createMatcher() const {
+    return new HNSWMatcher(M, efConstruction, efSearch, seed);
+  }
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["M"] >> M;
+    fn["efConstruction"] >> efConstruction;
+    fn["efSearch"] >> efSearch;
+    fn["seed"] >> seed;
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "M" << M;
+    fs << "efConstruction" << efConstruction;
+    fs << "efSearch" << efSearch;
+    fs << "seed" << seed;
+  }
+
+  virtual std::string getDefaultName() const { return "HNSWMatcherParameters"; }
+
+public:
+  int M;
+  int efConstruction;
+  int efSearch;
+  int seed;
+};
+
+//
+// Utility functions to create or read variants of MatcherParameters
+//
+
+static inline std::vector< std::string > getMatcherParameterNames() {
+  std::vector< std::string > names;
+  AIF_APPEND_DEFAULT_NAME(names, ResultMatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, BFMatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, KDTreeMatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, BlockedL2MatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, BlockedLayoutMatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, LshMatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, MIHMatcherParameters);
+  AIF_APPEND_DEFAULT_NAME(names, HNSWMatcherParameters);
+  return names;
+}
+
+static inline cv::Ptr< MatcherParameters > createMatcherParameters(const std::string &type_name) {
+  AIF_RETURN_IF_CREATE(ResultMatcherParameters);
+  AIF_RETURN_IF_CREATE(BFMatcherParameters);
+  AIF_RETURN_IF_CREATE(KDTreeMatcherParameters);
+  AIF_RETURN_IF_CREATE(BlockedL2MatcherParameters);
+  AIF_RETURN_IF_CREATE(BlockedLayoutMatcherParameters);
+  AIF_RETURN_IF_CREATE(LshMatcherParameters);
+  AIF_RETURN_IF_CREATE(MIHMatcherParameters);
+  AIF_RETURN_IF_CREATE(HNSWMatcherParameters);
+  return cv::Ptr< MatcherParameters >();
+}
+
+template <> cv::Ptr< MatcherParameters > load< MatcherParameters >(const cv::FileNode &fn) {
+  AIF_RETURN_IF_LOAD(ResultMatcherParameters);
+  AIF_RETURN_IF_LOAD(BFMatcherParameters);
+  AIF_RETURN_IF_LOAD(KDTreeMatcherParameters);
+  AIF_RETURN_IF_LOAD(BlockedL2MatcherParameters);
+  AIF_RETURN_IF_LOAD(BlockedLayoutMatcherParameters);
+  AIF_RETURN_IF_LOAD(LshMatcherParameters);
+  AIF_RETURN_IF_LOAD(MIHMatcherParameters);
+  AIF_RETURN_IF_LOAD(HNSWMatcherParameters);
+  return cv::Ptr< MatcherParameters >();
+}
+
+} // namespace affine_invariant_features
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef AFFINE_INVARIANT_FEATURES_NUMA_AFFINITY
+#define AFFINE_INVARIANT_FEATURES_NUMA_AFFINITY
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <opencv2/core.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace affine_invariant_features {
+
+//
+// NUMA topology read from sysfs. Only available on Linux.
+// On other platforms, the system is considered as a single node.
+//
+
+class NumaTopology {
+public:
+  // number of NUMA nodes (1 if unknown)
+  static int numNodes() {
+    static const int nnodes(countNodes());
+    return nnodes;
+  }
+
+  // CPUs belonging to the node
+  static std::vector< int > nodeCpus(const int node) {
+    std::vector< int > cpus;
+    std::ifstream ifs(
+        ("/sys/devices/system/node/node" + boost::lexical_cast< std::string >(node) + "/cpulist")
+            .c_str());
+    std::string list;
+    if (!std::getline(ifs, list)) {
+      return cpus;
+    }
+
+    // parse a list like "0-7,16-23"
+    std::istringstream iss(list);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+      const std::size_t dash(range.find('-'));
+      try {
+        const int first(boost::lexical_cast< int >(range.substr(0, dash)));
+        const int last(dash == std::string::npos
+                           ? first
+                           : boost::lexical_cast< int >(range.substr(dash + 1)));
+        for (int cpu = first; cpu <= last; ++cpu) {
+          cpus.push_back(cpu);
+        }
+      } catch (const boost::bad_lexical_cast &) {
+        continue;
+      }
+    }
+    return cpus;
+  }
+
+private:
+  static int countNodes() {
+    namespace bf = boost::filesystem;
+    int nnodes(0);
+    boost::system::error_code error;
+    while (bf::exists("/sys/devices/system/node/node" + boost::lexical_cast< std::string >(nnodes),
+                      error)) {
+      ++nnodes;
+    }
+    return std::max(nnodes, 1);
+  }
+};
+
+//
+// Pin the calling thread to CPUs of a NUMA node during the lifetime of this object.
+// The original affinity is restored on destruction.
+// Memory first touched by the thread is allocated on the node by the default policy of Linux.
+//
+
+class ScopedNodeAffinity {
+public:
+  ScopedNodeAffinity(const int node) : pinned_(false) {
+#ifdef __linux__
+    if (sched_getaffinity(0, sizeof(original_), &original_) != 0) {
+      return;
+    }
+
+    // CPUs of the node which the thread is allowed to run on
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    const std::vector< int > node_cpus(NumaTopology::nodeCpus(node));
+    for (std::vector< int >::const_iterator cpu = node_cpus.begin(); cpu != node_cpus.end();
+         ++cpu) {
+      if (*cpu < CPU_SETSIZE && CPU_ISSET(*cpu, &original_)) {
+        CPU_SET(*cpu, &cpus);
+      }
+    }
+    if (CPU_COUNT(&cpus) == 0) {
+      return;
+    }
+
+    pinned_ = (sched_setaffinity(0, sizeof(cpus), &cpus) == 0);
+#endif
+  }
+
+  virtual ~ScopedNodeAffinity() {
+#ifdef __linux__
+    if (pinned_) {
+      sched_setaffinity(0, sizeof(original_), &original_);
+    }
+#endif
+  }
+
+  bool pinned() const { return pinned_; }
+
+private:
+  bool pinned_;
+#ifdef __linux__
+  cpu_set_t original_;
+#endif
+};
+
+//
+// Copies of a source image and mask, one per NUMA node.
+// Each copy is created by the first thread running on the node
+// so that its pages are allocated on the node.
+//
+
+class NodeReplicas {
+public:
+  NodeReplicas(const cv::Mat &image, const cv::Mat &mask, const int nnodes)
+      : image_(image), mask_(mask), images_(nnodes), masks_(nnodes), mutexes_(nnodes) {
+    for (int i = 0; i < nnodes; ++i) {
+      mutexes_[i] = new cv::Mutex();
+    }
+  }
+
+  virtual ~NodeReplicas() {}
+
+  int numNodes() const { return images_.size(); }
+
+  void get(const int node, cv::Mat &image, cv::Mat &mask) {
+    const cv::AutoLock lock(*mutexes_[node]);
+    if (images_[node].empty()) {
+      images_[node] = image_.clone();
+      masks_[node] = mask_.clone();
+    }
+    image = images_[node];
+    mask = masks_[node];
+  }
+
+private:
+  const cv::Mat image_;
+  const cv::Mat mask_;
+  std::vector< cv::Mat > images_;
+  std::vector< cv::Mat > masks_;
+  std::vector< cv::Ptr< cv::Mutex > > mutexes_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef AFFINE_INVARIANT_FEATURES_REFERENCE_LOADER
+#define AFFINE_INVARIANT_FEATURES_REFERENCE_LOADER
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/matcher_parameters.hpp>
+#include <affine_invariant_features/parallel_tasks.hpp>
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/target.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <opencv2/core.hpp>
+
+namespace affine_invariant_features {
+
+//
+// A set of references loaded from result files in parallel.
+// Target images are not decoded on loading but retrieved on demand,
+// and hashes of the images can be verified on a background thread.
+//
+
+class ReferenceSet {
+public:
+  enum Verification { NOT_VERIFIED = -1, MISMATCHED = 0, VERIFIED = 1 };
+
+  struct Entry {
+    std::string path;
+    cv::Ptr< const TargetDescription > target;
+    cv::Ptr< const Results > results;
+    cv::Ptr< const ResultMatcher > matcher;
+  };
+
+public:
+  ReferenceSet() {}
+
+  virtual ~ReferenceSet() { waitVerification(); }
+
+  // list result files in the directory, or in the manifest which has one path per line.
+  // relative paths in the manifest are resolved from the directory of the manifest.
+  static std::vector< std::string > listFiles(const std::string &path) {
+    namespace bf = boost::filesystem;
+
+    std::vector< std::string > files;
+    if (bf::is_directory(path)) {
+      for (bf::directory_iterator entry(path); entry != bf::directory_iterator(); ++entry) {
+        const std::string ext(entry->path().extension().string());
+        if (bf::is_regular_file(entry->status()) &&
+            (ext == ".yml" || ext == ".yaml" || ext == ".xml" || ext == ".gz")) {
+          files.push_back(entry->path().string());
+        }
+      }
+      std::sort(files.begin(), files.end());
+    } else {
+      std::ifstream ifs(path.c_str());
+      const bf::path root(bf::path(path).parent_path());
+      std::string line;
+      while (std::getline(ifs, line)) {
+        if (line.empty() || line[0] == '#') {
+          continue;
+        }
+        const bf::path file(line);
+        files.push_back(file.is_absolute() ? file.string() : (root / file).string());
+      }
+    }
+    return files;
+  }
+
+  // load target descriptions and results, and build matchers concurrently.
+  // entries which could not be loaded have empty pointers (and errors are printed).
+  void load(const std::vector< std::string > &paths,
+            const cv::Ptr< const MatcherParameters > &matcher_params =
+                cv::Ptr< const MatcherParameters >(),
+            const double nstripes = -1., const bool build_matchers = true) {
+    waitVerification();
+
+    entries_.clear();
+    entries_.resize(paths.size());
+    verifications_.assign(paths.size(), NOT_VERIFIED);
+    target_data_.assign(paths.size(), cv::Ptr< const TargetData >());
+
+    ParallelTasks tasks(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+      entries_[i].path = paths[i];
+      tasks[i] = boost::bind(&ReferenceSet::loadTask, boost::ref(entries_[i]),
+                             boost::cref(matcher_params), build_matchers);
+    }
+    cv::parallel_for_(cv::Range(0, tasks.size()), tasks, nstripes);
+  }
+
+  std::size_t size() const { return entries_.size(); }
+
+  const Entry &operator[](const std::size_t i) const { return entries_[i]; }
+
+  // matchers in the order of entries, which can be passed to ResultMatcher::parallelMatch()
+  std::vector< cv::Ptr< const ResultMatcher > > getMatchers() const {
+    std::vector< cv::Ptr< const ResultMatcher > > matchers;
+    for (std::vector< Entry >::const_iterator entry = entries_.begin(); entry != entries_.end();
+         ++entry) {
+      matchers.push_back(entry->matcher);
+    }
+    return matchers;
+  }
+
+  // results in the order of entries, which can be indexed by InvertedIndex::build()
+  std::vector< cv::Ptr< const Results > > getResults() const {
+    std::vector< cv::Ptr< const Results > > results;
+    for (std::vector< Entry >::const_iterator entry = entries_.begin(); entry != entries_.end();
+         ++entry) {
+      results.push_back(entry->results);
+    }
+    return results;
+  }
+
+  // retrieve the target image and mask of the i-th entry on the first call.
+  // images are decoded out of the lock so that retrieving different entries does not serialize.
+  cv::Ptr< const TargetData > getTargetData(const std::size_t i) const {
+    {
+      const cv::AutoLock lock(mutex_);
+      if (target_data_[i] || !entries_[i].target) {
+        return target_data_[i];
+      }
+    }
+
+    const cv::Ptr< const TargetData > data(TargetData::retrieve(*entries_[i].target));
+
+    // keep the data published by another thread if it won the race
+    const cv::AutoLock lock(mutex_);
+    if (!target_data_[i]) {
+      target_data_[i] = data;
+    }
+    return target_data_[i];
+  }
+
+  //
+  // hash verification of target images on a background thread
+  //
+
+  void startVerification(const double nstripes = -1.) {
+    waitVerification();
+    verifier_.reset(new boost::thread(&ReferenceSet::verifyAll, this, nstripes));
+  }
+
+  void waitVerification() {
+    if (verifier_) {
+      verifier_->join();
+      verifier_.reset();
+    }
+  }
+
+  Verification getVerification(const std::size_t i) const {
+    const cv::AutoLock lock(mutex_);
+    return verifications_[i];
+  }
+
+private:
+  static void loadTask(Entry &entry, const cv::Ptr< const MatcherParameters > &matcher_params,
+                       const bool build_matcher) {
+    const cv::FileStorage file(entry.path, cv::FileStorage::READ);
+    if (!file.isOpened()) {
+      CV_Error_(cv::Error::StsError, ("Could not open %s", entry.path.c_str()));
+    }
+
+    // the entry is filled only after everything is loaded
+    // so that a failure leaves it with empty pointers
+    const cv::Ptr< const TargetDescription > target(
+        affine_invariant_features::load< TargetDescription >(file.root()));
+    if (!target) {
+      CV_Error_(cv::Error::StsError, ("Could not load a target description from %s",
+                                      entry.path.c_str()));
+    }
+
+    const cv::Ptr< const Results > results(affine_invariant_features::load< Results >(file.root()));
+    if (!results) {
+      CV_Error_(cv::Error::StsError, ("Could not load features from %s", entry.path.c_str()));
+    }
+
+    cv::Ptr< const ResultMatcher > matcher;
+    if (build_matcher) {
+      matcher = new ResultMatcher(results, matcher_params);
+    }
+
+    entry.target = target;
+    entry.results = results;
+    entry.matcher = matcher;
+  }
+
+  void verifyAll(const double nstripes) {
+    ParallelTasks tasks(entries_.size());
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+      if (entries_[i].target) {
+        tasks[i] = boost::bind(&ReferenceSet::verifyTask, this, i);
+      }
+    }
+    cv::parallel_for_(cv::Range(0, tasks.size()), tasks, nstripes);
+  }
+
+  void verifyTask(const std::size_t i) {
+    const bool matched(entries_[i].target->verifyHash());
+
+    const cv::AutoLock lock(mutex_);
+    verifications_[i] = matched ? VERIFIED : MISMATCHED;
+  }
+
+private:
+  std::vector< Entry > entries_;
+  std::vector< Verification > verifications_;
+  mutable std::vector< cv::Ptr< const TargetData > > target_data_;
+  mutable cv::Mutex mutex_;
+  boost::scoped_ptr< boost::thread > verifier_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
@@ -1,35 +1,58 @@
 #ifndef AFFINE_INVARIANT_FEATURES_RESULT_MATCHER
 #define AFFINE_INVARIANT_FEATURES_RESULT_MATCHER
 
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <utility>
 #include <vector>
 
+#include <affine_invariant_features/keypoint_grid.hpp>
+#include <affine_invariant_features/matcher_parameters.hpp>
 #include <affine_invariant_features/parallel_tasks.hpp>
 #include <affine_invariant_features/results.hpp>
 #include <ros/console.h>
 
 #include <boost/bind.hpp>
+#include <boost/lockfree/queue.hpp>
 #include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <opencv2/calib3d.hpp>
 #include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/flann.hpp>
+#include <opencv2/imgproc.hpp>
 
 namespace affine_invariant_features {
 
 class ResultMatcher {
 public:
-  ResultMatcher(const cv::Ptr< const Results > &reference) : reference_(reference) {
+  // the default matcher for the norm type of the reference is used if no matcher is given.
+  // thresholds of matching are also given if the parameters are ResultMatcherParameters.
+  ResultMatcher(const cv::Ptr< const Results > &reference,
+                const cv::Ptr< const MatcherParameters > &params =
+                    cv::Ptr< const MatcherParameters >())
+      : reference_(reference) {
     CV_Assert(reference_);
 
-    switch (reference_->normType) {
-    case cv::NORM_L2:
-      matcher_ = new cv::FlannBasedMatcher(new cv::flann::KDTreeIndexParams(4));
-      break;
-    case cv::NORM_HAMMING:
-      matcher_ = new cv::FlannBasedMatcher(new cv::flann::LshIndexParams(6, 12, 1));
-      break;
+    const cv::Ptr< const ResultMatcherParameters > result_params(
+        params.dynamicCast< const ResultMatcherParameters >());
+    if (result_params) {
+      params_ = *result_params;
+    }
+
+    if (params) {
+      if (!params->supportsNormType(reference_->normType)) {
+        CV_Error_(cv::Error::StsBadArg,
+                  ("The matcher of %s does not support the norm type (%d) of the reference",
+                   params->getDefaultName().c_str(), reference_->normType));
+      }
+      matcher_ = params->createMatcher();
+    }
+    if (!matcher_) {
+      matcher_ = createDefaultMatcher(*reference_);
     }
 
     CV_Assert(matcher_);
@@ -42,28 +65,324 @@ public:
 
   const Results &getReference() const { return *reference_; }
 
+  const ResultMatcherParameters &getParameters() const { return params_; }
+
+  static cv::Ptr< cv::DescriptorMatcher > createDefaultMatcher(const Results &reference) {
+    cv::Ptr< cv::DescriptorMatcher > matcher;
+    switch (reference.normType) {
+    case cv::NORM_L2:
+      // FLANN's kd-trees only accept float descriptors.
+      // quantized descriptors are matched by brute force which accepts 8-bit integers.
+      if (reference.isQuantized()) {
+        matcher = new cv::BFMatcher(cv::NORM_L2);
+      } else {
+        matcher = KDTreeMatcherParameters().createMatcher();
+      }
+      break;
+    case cv::NORM_HAMMING:
+      matcher = LshMatcherParameters().createMatcher();
+      break;
+    case cv::NORM_HAMMING2:
+      // e.g. ORB with WTA_K = 3 or 4. only the brute force matcher supports this norm.
+      matcher = new cv::BFMatcher(cv::NORM_HAMMING2);
+      break;
+    }
+    return matcher;
+  }
+
   void match(const Results &source, cv::Matx33f &transform, std::vector< cv::DMatch > &matches,
              const double min_match_ratio = 0.) const {
     // number of matches wanted
     const int n_min_matches(std::ceil(min_match_ratio * reference_->keypoints.size()));
 
-    // find the 1st & 2nd matches for each descriptor in the source
-    std::vector< std::vector< cv::DMatch > > all_matches;
-    matcher_->knnMatch(source.descriptors, all_matches, 2);
+    // find matches which are unique in the reference
+    std::vector< cv::DMatch > &unique_matches(getScratch().unique_matches);
+    findUniqueMatches(source, unique_matches);
 
-    // filter unique matches whose 1st is enough better than 2nd
-    std::vector< cv::DMatch > unique_matches;
+    // further filter matches compatible to a registration
+    verifyMatches(source, unique_matches, n_min_matches, transform, matches);
+  }
+
+  // match with a prior transform from the source to the reference (e.g. one of the last frame).
+  // each source keypoint is only compared to reference keypoints within the radius
+  // from its position projected by the prior. falls back to match() if this finds no matches.
+  void guidedMatch(const Results &source, const cv::Matx33f &prior, const double radius,
+                   cv::Matx33f &transform, std::vector< cv::DMatch > &matches,
+                   const double min_match_ratio = 0.) const {
+    // number of matches wanted
+    const int n_min_matches(std::ceil(min_match_ratio * reference_->keypoints.size()));
+
+    // find matches which are unique in the neighborhoods
+    std::vector< cv::DMatch > &unique_matches(getScratch().unique_matches);
+    findLocalUniqueMatches(source, prior, radius, unique_matches);
+
+    // further filter matches compatible to a registration
+    verifyMatches(source, unique_matches, n_min_matches, transform, matches);
+
+    // fall back to the global search
+    if (matches.empty()) {
+      match(source, transform, matches, min_match_ratio);
+    }
+  }
+
+  // match only source keypoints inside the region of interest of the source image.
+  // keypoints are selected by the source index if given, which must be built
+  // on the current source keypoints (see Results::selectKeypoints()).
+  // query indices of the output matches are ones in the whole source.
+  void matchRegion(const Results &source, const cv::Rect2f &roi, cv::Matx33f &transform,
+                   std::vector< cv::DMatch > &matches, const double min_match_ratio = 0.,
+                   const KeypointGrid *source_index = NULL) const {
+    std::vector< int > indices;
+    source.selectKeypoints(roi, indices, source_index);
+    matchSelected(source, indices, transform, matches, min_match_ratio);
+  }
+
+  // match only source keypoints on nonzero pixels of the mask
+  void matchRegion(const Results &source, const cv::Mat &mask, cv::Matx33f &transform,
+                   std::vector< cv::DMatch > &matches, const double min_match_ratio = 0.,
+                   const KeypointGrid *source_index = NULL) const {
+    std::vector< int > indices;
+    source.selectKeypoints(mask, indices, source_index);
+    matchSelected(source, indices, transform, matches, min_match_ratio);
+  }
+
+  // match the source against all matchers in parallel.
+  // if a queue is given, the index of each matcher is pushed to it as soon as the matcher succeeds
+  // so that another thread can consume results (transforms[i] and matches_array[i])
+  // before all matchers finish. the outputs must not be resized during the call.
+  static void parallelMatch(const std::vector< cv::Ptr< const ResultMatcher > > &matchers,
+                            const Results &source, std::vector< cv::Matx33f > &transforms,
+                            std::vector< std::vector< cv::DMatch > > &matches_array,
+                            const std::vector< double > &min_match_ratios = std::vector< double >(),
+                            const double nstripes = -1.,
+                            boost::lockfree::queue< int > *verified = NULL) {
+    CV_Assert(min_match_ratios.empty() || matchers.size() == min_match_ratios.size());
+
+    // initiate output
+    const int ntasks(matchers.size());
+    transforms.resize(ntasks, cv::Matx33f::eye());
+    matches_array.resize(ntasks);
+
+    // populate tasks
+    ParallelTasks tasks(ntasks);
+    for (int i = 0; i < ntasks; ++i) {
+      if (!matchers[i]) {
+        continue;
+      }
+      if (verified) {
+        tasks[i] = boost::bind(&ResultMatcher::matchAndNotify, matchers[i].get(),
+                               boost::ref(source), boost::ref(transforms[i]),
+                               boost::ref(matches_array[i]),
+                               min_match_ratios.empty() ? 0. : min_match_ratios[i], i, verified);
+      } else {
+        tasks[i] = boost::bind(&ResultMatcher::match, matchers[i].get(), boost::ref(source),
+                               boost::ref(transforms[i]), boost::ref(matches_array[i]),
+                               min_match_ratios.empty() ? 0. : min_match_ratios[i]);
+      }
+    }
+
+    // do paralell matching
+    cv::parallel_for_(cv::Range(0, ntasks), tasks, nstripes);
+  }
+
+  // find the first matcher which matches the source.
+  // matchers are first ranked by the number of unique matches of randomly sampled source
+  // descriptors, and then fully verified in the ranked order (in batches of the number of threads)
+  // until one succeeds. returns the index of the successful matcher, or -1 if no one succeeds.
+  static int cascadeMatch(const std::vector< cv::Ptr< const ResultMatcher > > &matchers,
+                          const Results &source, cv::Matx33f &transform,
+                          std::vector< cv::DMatch > &matches,
+                          const std::vector< double > &min_match_ratios = std::vector< double >(),
+                          const int nsamples = 128, const int max_candidates = 0,
+                          const double nstripes = -1.) {
+    CV_Assert(min_match_ratios.empty() || matchers.size() == min_match_ratios.size());
+
+    // initiate output
+    transform = cv::Matx33f::eye();
+    matches.clear();
+
+    // score matchers with sampled source descriptors
+    const int nmatchers(matchers.size());
+    std::vector< int > scores(nmatchers, -1);
+    {
+      Results samples;
+      sampleResults(source, nsamples, samples);
+      ParallelTasks tasks(nmatchers);
+      for (int i = 0; i < nmatchers; ++i) {
+        if (matchers[i]) {
+          tasks[i] = boost::bind(&ResultMatcher::countUniqueMatches, matchers[i].get(),
+                                 boost::cref(samples), boost::ref(scores[i]));
+        }
+      }
+      cv::parallel_for_(cv::Range(0, nmatchers), tasks, nstripes);
+    }
+
+    // rank matchers in descending order of the scores
+    std::vector< std::pair< int, int > > ranks;
+    for (int i = 0; i < nmatchers; ++i) {
+      if (scores[i] >= 0) {
+        ranks.push_back(std::make_pair(-scores[i], i));
+      }
+    }
+    std::stable_sort(ranks.begin(), ranks.end());
+    if (max_candidates > 0 && ranks.size() > static_cast< std::size_t >(max_candidates)) {
+      ranks.resize(max_candidates);
+    }
+
+    // verify candidates in batches. a batch is never started once a candidate succeeds.
+    const int batch_size(std::max(cv::getNumThreads(), 1));
+    for (std::size_t begin = 0; begin < ranks.size(); begin += batch_size) {
+      const int ntasks(std::min(ranks.size() - begin, static_cast< std::size_t >(batch_size)));
+      std::vector< cv::Matx33f > transforms(ntasks, cv::Matx33f::eye());
+      std::vector< std::vector< cv::DMatch > > matches_array(ntasks);
+      ParallelTasks tasks(ntasks);
+      for (int i = 0; i < ntasks; ++i) {
+        const int idx(ranks[begin + i].second);
+        tasks[i] = boost::bind(&ResultMatcher::match, matchers[idx].get(), boost::ref(source),
+                               boost::ref(transforms[i]), boost::ref(matches_array[i]),
+                               min_match_ratios.empty() ? 0. : min_match_ratios[idx]);
+      }
+      cv::parallel_for_(cv::Range(0, ntasks), tasks, nstripes);
+
+      // take the best ranked success in the batch
+      for (int i = 0; i < ntasks; ++i) {
+        if (!matches_array[i].empty()) {
+          transform = transforms[i];
+          matches.swap(matches_array[i]);
+          return ranks[begin + i].second;
+        }
+      }
+    }
+
+    return -1;
+  }
+
+private:
+  // find the 1st & 2nd matches for each descriptor in the source,
+  // and filter unique matches whose 1st is enough better than 2nd
+  void findUniqueMatches(const Results &source, std::vector< cv::DMatch > &unique_matches) const {
+    // (after converting the source descriptors into the representation of the reference)
+    std::vector< std::vector< cv::DMatch > > &all_matches(getScratch().all_matches);
+    {
+      cv::Mat source_descriptors;
+      source.getDescriptorsAs(*reference_, source_descriptors);
+      matcher_->knnMatch(source_descriptors, all_matches, 2);
+    }
+
+    unique_matches.clear();
     for (std::vector< std::vector< cv::DMatch > >::const_iterator m = all_matches.begin();
          m != all_matches.end(); ++m) {
       if (m->size() < 2) {
         continue;
       }
-      if ((*m)[0].distance > 0.75 * (*m)[1].distance) {
+      if ((*m)[0].distance > params_.ratioThreshold * (*m)[1].distance) {
         continue;
       }
       unique_matches.push_back((*m)[0]);
     }
-    if (unique_matches.size() < std::max(n_min_matches, 4)) {
+  }
+
+  // find the 1st & 2nd matches for each source descriptor among reference keypoints
+  // around the projected position, and filter unique matches as findUniqueMatches()
+  void findLocalUniqueMatches(const Results &source, const cv::Matx33f &prior,
+                              const double radius,
+                              std::vector< cv::DMatch > &unique_matches) const {
+    unique_matches.clear();
+    const KeypointGrid &reference_grid(getReferenceGrid());
+    if (source.keypoints.empty() || reference_grid.empty()) {
+      return;
+    }
+
+    // project source keypoints onto the reference
+    Scratch &scratch(getScratch());
+    std::vector< cv::Point2f > &source_points(scratch.source_points);
+    std::vector< cv::Point2f > &projected_points(scratch.projected_points);
+    source_points.clear();
+    for (std::vector< cv::KeyPoint >::const_iterator kp = source.keypoints.begin();
+         kp != source.keypoints.end(); ++kp) {
+      source_points.push_back(kp->pt);
+    }
+    cv::perspectiveTransform(source_points, projected_points, cv::Mat(prior));
+
+    // (after converting the source descriptors into the representation of the reference)
+    cv::Mat source_descriptors;
+    source.getDescriptorsAs(*reference_, source_descriptors);
+
+    std::vector< int > &candidates(scratch.candidates);
+    for (int i = 0; i < source_descriptors.rows; ++i) {
+      reference_grid.radiusSearch(projected_points[i], radius, candidates);
+      if (candidates.size() < 2) {
+        continue;
+      }
+
+      // the 1st & 2nd nearest candidates
+      cv::DMatch first(i, -1, FLT_MAX), second(i, -1, FLT_MAX);
+      for (std::vector< int >::const_iterator c = candidates.begin(); c != candidates.end();
+           ++c) {
+        const float dist(cv::norm(source_descriptors.row(i), reference_->descriptors.row(*c),
+                                  reference_->normType));
+        if (dist < first.distance) {
+          second = first;
+          first = cv::DMatch(i, *c, dist);
+        } else if (dist < second.distance) {
+          second = cv::DMatch(i, *c, dist);
+        }
+      }
+
+      if (first.distance > params_.ratioThreshold * second.distance) {
+        continue;
+      }
+      unique_matches.push_back(first);
+    }
+  }
+
+  // match(), and then push the index to the queue if succeeded
+  void matchAndNotify(const Results &source, cv::Matx33f &transform,
+                      std::vector< cv::DMatch > &matches, const double min_match_ratio,
+                      const int index, boost::lockfree::queue< int > *verified) const {
+    match(source, transform, matches, min_match_ratio);
+    if (!matches.empty()) {
+      // push() only fails if the queue has a fixed capacity and is full
+      while (!verified->push(index)) {
+        boost::this_thread::yield();
+      }
+    }
+  }
+
+  // match the selected source keypoints as match().
+  // only the selected rows of the source descriptors are gathered for the descriptor matcher.
+  void matchSelected(const Results &source, const std::vector< int > &indices,
+                     cv::Matx33f &transform, std::vector< cv::DMatch > &matches,
+                     const double min_match_ratio) const {
+    // number of matches wanted
+    const int n_min_matches(std::ceil(min_match_ratio * reference_->keypoints.size()));
+
+    // find unique matches of the selected keypoints, and then map them to the whole source
+    Scratch &scratch(getScratch());
+    std::vector< cv::DMatch > &unique_matches(scratch.unique_matches);
+    source.select(indices, scratch.selected);
+    findUniqueMatches(scratch.selected, unique_matches);
+    for (std::vector< cv::DMatch >::iterator m = unique_matches.begin();
+         m != unique_matches.end(); ++m) {
+      m->queryIdx = indices[m->queryIdx];
+    }
+
+    // further filter matches compatible to a registration
+    verifyMatches(source, unique_matches, n_min_matches, transform, matches);
+  }
+
+  void countUniqueMatches(const Results &source, int &count) const {
+    std::vector< cv::DMatch > &unique_matches(getScratch().unique_matches);
+    findUniqueMatches(source, unique_matches);
+    count = unique_matches.size();
+  }
+
+  // estimate a transform from the source to the reference using the given unique matches,
+  // and pack matches compatible to the transform
+  void verifyMatches(const Results &source, const std::vector< cv::DMatch > &unique_matches,
+                     const int n_min_matches, cv::Matx33f &transform,
+                     std::vector< cv::DMatch > &matches) const {
+    if (unique_matches.size() < std::max(n_min_matches, std::max(params_.minMatches, 4))) {
       // abort if the number of unique matches is less than required.
       // 4 is the minimum requirement for cv::findHomography().
       matches.clear();
@@ -71,17 +390,46 @@ public:
     }
 
     // further filter matches compatible to a registration
-    std::vector< unsigned char > mask;
+    Scratch &scratch(getScratch());
+    std::vector< unsigned char > &mask(scratch.mask);
     {
-      std::vector< cv::Point2f > source_points;
-      std::vector< cv::Point2f > reference_points;
+      std::vector< cv::Point2f > &source_points(scratch.source_points);
+      std::vector< cv::Point2f > &reference_points(scratch.reference_points);
+      source_points.clear();
+      reference_points.clear();
       for (std::vector< cv::DMatch >::const_iterator m = unique_matches.begin();
            m != unique_matches.end(); ++m) {
         source_points.push_back(source.keypoints[m->queryIdx].pt);
         reference_points.push_back(reference_->keypoints[m->trainIdx].pt);
       }
+
+      // LMEDS classifies inliers by the median error instead of reprojectionThreshold,
+      // so its inliers cannot be re-derived by findInliers() for sampling or polishing
+      const bool thresholded(params_.estimator != cv::LMEDS);
+
+      // estimate a hypothesis on a subsample uniformly distributed over the source image
+      // if there are too many matches. this bounds the cost of the robust estimation.
+      const bool sampled(thresholded && params_.verificationSamples > 0 &&
+                         unique_matches.size() >
+                             static_cast< std::size_t >(params_.verificationSamples));
+      std::vector< cv::Point2f > &sample_source_points(scratch.sample_source_points);
+      std::vector< cv::Point2f > &sample_reference_points(scratch.sample_reference_points);
+      sample_source_points.clear();
+      sample_reference_points.clear();
+      if (sampled) {
+        std::vector< int > &indices(scratch.indices);
+        sampleStratified(source_points, params_.verificationSamples, indices);
+        for (std::vector< int >::const_iterator i = indices.begin(); i != indices.end(); ++i) {
+          sample_source_points.push_back(source_points[*i]);
+          sample_reference_points.push_back(reference_points[*i]);
+        }
+      }
+
       try {
-        transform = cv::findHomography(source_points, reference_points, cv::RANSAC, 5., mask);
+        transform = cv::findHomography(sampled ? sample_source_points : source_points,
+                                       sampled ? sample_reference_points : reference_points,
+                                       params_.estimator, params_.reprojectionThreshold, mask,
+                                       params_.maxIters, params_.confidence);
       } catch (const cv::Exception & /* error */) {
         // abort if cv::findHomography() is failed. this can happen when no good transform is found.
         ROS_INFO("An exception from cv::findHomography() was properly handled. "
@@ -89,6 +437,16 @@ public:
         matches.clear();
         return;
       }
+
+      // score the hypothesis on all matches
+      if (sampled) {
+        findInliers(transform, source_points, reference_points, mask);
+      }
+
+      // polish the transform by least squares on the inliers
+      if (thresholded) {
+        polishTransform(source_points, reference_points, transform, mask);
+      }
     }
 
     // pack the final matches
@@ -99,42 +457,173 @@ public:
       }
       matches.push_back(unique_matches[i]);
     }
-    if (matches.size() < n_min_matches) {
+    if (matches.size() < std::max(n_min_matches, params_.minMatches)) {
       // abort if the number of matches is not enough
       matches.clear();
       return;
     }
   }
 
-  static void parallelMatch(const std::vector< cv::Ptr< const ResultMatcher > > &matchers,
-                            const Results &source, std::vector< cv::Matx33f > &transforms,
-                            std::vector< std::vector< cv::DMatch > > &matches_array,
-                            const std::vector< double > &min_match_ratios = std::vector< double >(),
-                            const double nstripes = -1.) {
-    CV_Assert(min_match_ratios.empty() || matchers.size() == min_match_ratios.size());
+  // refine the transform by least squares on the inliers while the number of inliers increases
+  void polishTransform(const std::vector< cv::Point2f > &source_points,
+                       const std::vector< cv::Point2f > &reference_points, cv::Matx33f &transform,
+                       std::vector< unsigned char > &mask) const {
+    Scratch &scratch(getScratch());
+    int ninliers(cv::countNonZero(mask));
+    for (int iter = 0; iter < params_.polishIters && ninliers >= 4; ++iter) {
+      std::vector< cv::Point2f > &inlier_source_points(scratch.inlier_source_points);
+      std::vector< cv::Point2f > &inlier_reference_points(scratch.inlier_reference_points);
+      inlier_source_points.clear();
+      inlier_reference_points.clear();
+      for (std::size_t i = 0; i < mask.size(); ++i) {
+        if (mask[i] != 0) {
+          inlier_source_points.push_back(source_points[i]);
+          inlier_reference_points.push_back(reference_points[i]);
+        }
+      }
 
-    // initiate output
-    const int ntasks(matchers.size());
-    transforms.resize(ntasks, cv::Matx33f::eye());
-    matches_array.resize(ntasks);
+      cv::Mat polished;
+      try {
+        polished = cv::findHomography(inlier_source_points, inlier_reference_points, 0);
+      } catch (const cv::Exception & /* error */) {
+        return;
+      }
+      if (polished.empty()) {
+        return;
+      }
 
-    // populate tasks
-    ParallelTasks tasks(ntasks);
-    for (int i = 0; i < ntasks; ++i) {
-      if (matchers[i]) {
-        tasks[i] = boost::bind(&ResultMatcher::match, matchers[i].get(), boost::ref(source),
-                               boost::ref(transforms[i]), boost::ref(matches_array[i]),
-                               min_match_ratios.empty() ? 0. : min_match_ratios[i]);
+      // accept the polished transform only if it does not lose inliers
+      std::vector< unsigned char > &polished_mask(scratch.polished_mask);
+      const int polished_ninliers(
+          findInliers(polished, source_points, reference_points, polished_mask));
+      if (polished_ninliers < ninliers) {
+        return;
       }
+      transform = polished;
+      mask.swap(polished_mask);
+      if (polished_ninliers == ninliers) {
+        return;
+      }
+      ninliers = polished_ninliers;
     }
+  }
 
-    // do paralell matching
-    cv::parallel_for_(cv::Range(0, ntasks), tasks, nstripes);
+  // mark matches whose reprojection errors are within the threshold.
+  // returns the number of inliers.
+  int findInliers(const cv::Matx33f &transform, const std::vector< cv::Point2f > &source_points,
+                  const std::vector< cv::Point2f > &reference_points,
+                  std::vector< unsigned char > &mask) const {
+    std::vector< cv::Point2f > &projected_points(getScratch().projected_points);
+    cv::perspectiveTransform(source_points, projected_points, cv::Mat(transform));
+
+    const double sq_threshold(params_.reprojectionThreshold * params_.reprojectionThreshold);
+    int ninliers(0);
+    mask.resize(source_points.size());
+    for (std::size_t i = 0; i < source_points.size(); ++i) {
+      const cv::Point2f d(projected_points[i] - reference_points[i]);
+      mask[i] = (d.x * d.x + d.y * d.y <= sq_threshold) ? 1 : 0;
+      ninliers += mask[i];
+    }
+    return ninliers;
+  }
+
+  // sample points uniformly over their bounding box.
+  // points are bucketed by a grid, and then picked from each bucket in round robin.
+  static void sampleStratified(const std::vector< cv::Point2f > &points, const int nsamples,
+                               std::vector< int > &indices) {
+    indices.clear();
+    if (points.empty() || nsamples <= 0) {
+      return;
+    }
+
+    const cv::Rect bbox(cv::boundingRect(points));
+    const int grid_size(std::ceil(std::sqrt(static_cast< double >(nsamples))));
+    std::vector< std::vector< int > > buckets(grid_size * grid_size);
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      const int col(std::min< int >((points[i].x - bbox.x) * grid_size / (bbox.width + 1),
+                                    grid_size - 1));
+      const int row(std::min< int >((points[i].y - bbox.y) * grid_size / (bbox.height + 1),
+                                    grid_size - 1));
+      buckets[row * grid_size + col].push_back(i);
+    }
+
+    const std::size_t nwanted(std::min< std::size_t >(nsamples, points.size()));
+    for (std::size_t round = 0; indices.size() < nwanted; ++round) {
+      for (std::size_t b = 0; b < buckets.size() && indices.size() < nwanted; ++b) {
+        if (round < buckets[b].size()) {
+          indices.push_back(buckets[b][round]);
+        }
+      }
+    }
+  }
+
+  // randomly sample keypoints and descriptors of the source without replacement
+  static void sampleResults(const Results &source, const int nsamples, Results &samples) {
+    samples.normType = source.normType;
+    samples.descriptorScale = source.descriptorScale;
+    samples.descriptorOffset = source.descriptorOffset;
+    const int nrows(source.descriptors.rows);
+    if (nsamples <= 0 || nrows <= nsamples) {
+      samples.keypoints = source.keypoints;
+      samples.descriptors = source.descriptors;
+      return;
+    }
+
+    // partial Fisher-Yates shuffle with a fixed seed for reproducibility
+    std::vector< int > indices(nrows);
+    for (int i = 0; i < nrows; ++i) {
+      indices[i] = i;
+    }
+    cv::RNG rng(0);
+    for (int i = 0; i < nsamples; ++i) {
+      std::swap(indices[i], indices[i + rng.uniform(0, nrows - i)]);
+    }
+
+    samples.keypoints.resize(nsamples);
+    samples.descriptors.create(nsamples, source.descriptors.cols, source.descriptors.type());
+    for (int i = 0; i < nsamples; ++i) {
+      samples.keypoints[i] = source.keypoints[indices[i]];
+      source.descriptors.row(indices[i]).copyTo(samples.descriptors.row(i));
+    }
+  }
+
+  //
+  // per-thread buffers reused by matching tasks to avoid contention on the global allocator
+  //
+
+  struct Scratch {
+    std::vector< std::vector< cv::DMatch > > all_matches;
+    std::vector< cv::DMatch > unique_matches;
+    std::vector< cv::Point2f > source_points, reference_points;
+    std::vector< cv::Point2f > sample_source_points, sample_reference_points;
+    std::vector< cv::Point2f > inlier_source_points, inlier_reference_points;
+    std::vector< cv::Point2f > projected_points;
+    std::vector< unsigned char > mask, polished_mask;
+    std::vector< int > indices, candidates;
+    Results selected;
+  };
+
+  // the grid over reference keypoints, which is built on the first guided matching
+  // so that matchers never used for guided matching do not pay for it
+  const KeypointGrid &getReferenceGrid() const {
+    const cv::AutoLock lock(grid_mutex_);
+    if (!reference_grid_) {
+      reference_grid_ = new KeypointGrid(reference_->keypoints);
+    }
+    return *reference_grid_;
+  }
+
+  static Scratch &getScratch() {
+    static cv::TLSData< Scratch > scratch;
+    return *scratch.get();
   }
 
 private:
   const cv::Ptr< const Results > reference_;
+  ResultMatcherParameters params_;
   cv::Ptr< cv::DescriptorMatcher > matcher_;
+  mutable cv::Mutex grid_mutex_;
+  mutable cv::Ptr< const KeypointGrid > reference_grid_;
 };
 
 } // namespace affine_invariant_features
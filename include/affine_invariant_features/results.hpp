@@ -1,19 +1,22 @@
 #ifndef AFFINE_INVARIANT_FEATURES_RESULTS
 #define AFFINE_INVARIANT_FEATURES_RESULTS
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/keypoint_grid.hpp>
 
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
 
 namespace affine_invariant_features {
 
 struct Results : public CvSerializable {
 public:
-  Results() {}
+  Results() : normType(cv::NORM_L2), descriptorScale(1.), descriptorOffset(0.) {}
 
   virtual ~Results() {}
 
@@ -21,22 +24,146 @@ public:
     fn["keypoints"] >> keypoints;
     fn["descriptors"] >> descriptors;
     fn["normType"] >> normType;
+    // parameters of quantization, which are only written for quantized descriptors
+    cv::read(fn["descriptorScale"], descriptorScale, 1.);
+    cv::read(fn["descriptorOffset"], descriptorOffset, 0.);
   }
 
   virtual void write(cv::FileStorage &fs) const {
     fs << "keypoints" << keypoints;
     fs << "descriptors" << descriptors;
     fs << "normType" << normType;
+    if (isQuantized()) {
+      fs << "descriptorScale" << descriptorScale;
+      fs << "descriptorOffset" << descriptorOffset;
+    }
   }
 
   virtual std::string getDefaultName() const { return "Results"; }
 
+  //
+  // compact storage of float descriptors
+  //
+
+  // true if float descriptors have been quantized into 8-bit integers by quantizeDescriptors()
+  bool isQuantized() const { return normType == cv::NORM_L2 && descriptors.depth() == CV_8U; }
+
+  // quantize float descriptors into 8-bit integers (1/4 of the original size).
+  // a common scale and offset is used for all dimensions so that L2 distances
+  // between quantized descriptors are proportional to the original ones
+  // and ratio tests can be performed without dequantization.
+  void quantizeDescriptors() {
+    if (normType != cv::NORM_L2 || descriptors.depth() != CV_32F || descriptors.empty()) {
+      return;
+    }
+
+    double min_val, max_val;
+    cv::minMaxLoc(descriptors, &min_val, &max_val);
+    descriptorOffset = min_val;
+    descriptorScale = (max_val > min_val) ? 255. / (max_val - min_val) : 1.;
+
+    cv::Mat quantized;
+    descriptors.convertTo(quantized, CV_8U, descriptorScale, -descriptorOffset * descriptorScale);
+    descriptors = quantized;
+  }
+
+  // get descriptors in the representation (float or quantized) of the given results
+  // so that they can be matched against the descriptors of the given results
+  void getDescriptorsAs(const Results &other, cv::Mat &dst) const {
+    // no conversion if the representations are same
+    if (!isQuantized() && !other.isQuantized()) {
+      dst = descriptors;
+      return;
+    }
+    if (isQuantized() && other.isQuantized() && descriptorScale == other.descriptorScale &&
+        descriptorOffset == other.descriptorOffset) {
+      dst = descriptors;
+      return;
+    }
+
+    // convert via float descriptors
+    cv::Mat float_descriptors;
+    if (isQuantized()) {
+      descriptors.convertTo(float_descriptors, CV_32F, 1. / descriptorScale, descriptorOffset);
+    } else {
+      float_descriptors = descriptors;
+    }
+    if (other.isQuantized()) {
+      float_descriptors.convertTo(dst, CV_8U, other.descriptorScale,
+                                  -other.descriptorOffset * other.descriptorScale);
+    } else {
+      dst = float_descriptors;
+    }
+  }
+
+  //
+  // spatial queries on keypoints
+  //
+
+  // ascending indices of keypoints inside the region of interest.
+  // if given, the index is used instead of scanning all keypoints.
+  // the caller owns the index, which must be built on the current keypoints
+  // (i.e. KeypointGrid(keypoints) after their last modification).
+  // Results does not keep an index itself because it cannot detect modifications of keypoints.
+  void selectKeypoints(const cv::Rect2f &roi, std::vector< int > &indices,
+                       const KeypointGrid *index = NULL) const {
+    if (index) {
+      index->rectSearch(roi, indices);
+      std::sort(indices.begin(), indices.end());
+      return;
+    }
+    indices.clear();
+    for (std::size_t i = 0; i < keypoints.size(); ++i) {
+      if (roi.contains(keypoints[i].pt)) {
+        indices.push_back(i);
+      }
+    }
+  }
+
+  // ascending indices of keypoints on nonzero pixels of the 8-bit mask
+  void selectKeypoints(const cv::Mat &mask, std::vector< int > &indices,
+                       const KeypointGrid *index = NULL) const {
+    CV_Assert(mask.type() == CV_8UC1);
+    indices.clear();
+    std::vector< cv::Point > nonzeros;
+    cv::findNonZero(mask, nonzeros);
+    if (nonzeros.empty()) {
+      return;
+    }
+    const cv::Rect bounds(cv::boundingRect(nonzeros));
+    std::vector< int > candidates;
+    selectKeypoints(cv::Rect2f(bounds.x, bounds.y, bounds.width, bounds.height), candidates,
+                    index);
+    for (std::vector< int >::const_iterator i = candidates.begin(); i != candidates.end(); ++i) {
+      const cv::Point pt(keypoints[*i].pt.x, keypoints[*i].pt.y); // truncation, not rounding
+      if (mask.at< uchar >(pt) != 0) {
+        indices.push_back(*i);
+      }
+    }
+  }
+
+  // results consisting of the selected keypoints and rows of descriptors
+  void select(const std::vector< int > &indices, Results &dst) const {
+    dst.keypoints.clear();
+    dst.descriptors.create(indices.size(), descriptors.cols, descriptors.type());
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+      dst.keypoints.push_back(keypoints[indices[i]]);
+      descriptors.row(indices[i]).copyTo(dst.descriptors.row(i));
+    }
+    dst.normType = normType;
+    dst.descriptorScale = descriptorScale;
+    dst.descriptorOffset = descriptorOffset;
+  }
+
 public:
   std::vector< cv::KeyPoint > keypoints;
   cv::Mat descriptors;
   int normType; // cv::NormTypes
+  // quantized = original * descriptorScale - descriptorOffset * descriptorScale
+  double descriptorScale;
+  double descriptorOffset;
 };
 
 } // namespace affine_invariant_features
 
-#endif
\ No newline at end of file
+#endif
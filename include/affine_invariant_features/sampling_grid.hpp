@@ -0,0 +1,57 @@
+#ifndef AFFINE_INVARIANT_FEATURES_SAMPLING_GRID
+#define AFFINE_INVARIANT_FEATURES_SAMPLING_GRID
+
+#include <cstddef>
+
+namespace affine_invariant_features {
+
+//
+// Grids of affine simulations (rotation phi in degrees and tilt) for AffineInvariantFeatureT.
+// A grid is a compile-time table with the following static members.
+//   SIZE: the number of simulations
+//   phi(i), tilt(i): parameters of the i-th simulation
+//   isIdentity(i): true if the i-th simulation does not warp the image
+//
+
+// the sampling of ASIFT (Morel & Yu, SIAM J. Imaging Sciences 2009):
+// tilts of sqrt(2)^k (k = 0 to 5) and rotations in steps of 72 / tilt in [0, 180)
+struct AsiftSamplingGrid {
+  enum { SIZE = 43 };
+
+  static float phi(const std::size_t i) {
+    static const float table[SIZE] = {
+        0.f, 0.f, 50.9116882f, 101.823376f, 152.735065f, 0.f, 36.f, 72.f, 108.f, 144.f, 0.f,
+        25.4558441f, 50.9116882f, 76.3675324f, 101.823376f, 127.279221f, 152.735065f, 178.190909f,
+        0.f, 18.f, 36.f, 54.f, 72.f, 90.f, 108.f, 126.f, 144.f, 162.f, 0.f, 12.7279221f,
+        25.4558441f, 38.1837662f, 50.9116882f, 63.6396103f, 76.3675324f, 89.0954544f, 101.823376f,
+        114.551299f, 127.279221f, 140.007143f, 152.735065f, 165.462987f, 178.190909f};
+    return table[i];
+  }
+
+  static float tilt(const std::size_t i) {
+    static const float table[SIZE] = {
+        1.f, 1.41421356f, 1.41421356f, 1.41421356f, 1.41421356f, 2.f, 2.f, 2.f, 2.f, 2.f,
+        2.82842712f, 2.82842712f, 2.82842712f, 2.82842712f, 2.82842712f, 2.82842712f, 2.82842712f,
+        2.82842712f, 4.f, 4.f, 4.f, 4.f, 4.f, 4.f, 4.f, 4.f, 4.f, 4.f, 5.65685425f, 5.65685425f,
+        5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f,
+        5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f, 5.65685425f};
+    return table[i];
+  }
+
+  static bool isIdentity(const std::size_t i) { return phi(i) == 0.f && tilt(i) == 1.f; }
+};
+
+// no simulation. the backend is applied to the original image only.
+struct IdentitySamplingGrid {
+  enum { SIZE = 1 };
+
+  static float phi(const std::size_t /* i */) { return 0.f; }
+
+  static float tilt(const std::size_t /* i */) { return 1.f; }
+
+  static bool isIdentity(const std::size_t /* i */) { return true; }
+};
+
+} // namespace affine_invariant_features
+
+#endif
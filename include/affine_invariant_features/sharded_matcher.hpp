@@ -0,0 +1,680 @@
+#ifndef AFFINE_INVARIANT_FEATURES_SHARDED_MATCHER
+#define AFFINE_INVARIANT_FEATURES_SHARDED_MATCHER
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/matcher_parameters.hpp>
+#include <affine_invariant_features/reference_loader.hpp>
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include <opencv2/core.hpp>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace affine_invariant_features {
+
+//
+// References partitioned over worker processes on the local host.
+// Each worker loads its shard into ResultMatchers and serves match requests
+// over a Unix domain socket. Because workers have their own heaps, the reference database
+// can exceed what one process comfortably holds, and a crashing worker only drops its shard
+// (it is restarted on the next request).
+//
+// start() forks a zygote, a single-threaded process which forks (and later re-forks) workers
+// and hands their sockets to the front end. Call start() before other OpenCV parallel processing
+// in the front end process because threads are not inherited by forked children.
+// Workers forked by the zygote start without threads at any time.
+// A worker which does not finish loading or replying within the timeout is killed
+// like a crashed one.
+//
+
+class ShardedMatcher {
+public:
+  ShardedMatcher() : nstripes_(-1.), timeout_(0.), zygote_pid_(-1), zygote_fd_(-1) {}
+
+  virtual ~ShardedMatcher() { stop(); }
+
+  // partition references (paths of result files) into nshards in round robin,
+  // fork the zygote and one worker per shard.
+  // timeout is the limit in seconds for a worker to load its shard or to reply (0 for no limit).
+  void start(const std::vector< std::string > &paths, const int nshards,
+             const cv::Ptr< const MatcherParameters > &matcher_params =
+                 cv::Ptr< const MatcherParameters >(),
+             const double nstripes = -1., const double timeout = 600.) {
+    CV_Assert(nshards > 0);
+    CV_Assert(timeout >= 0.);
+
+    stop();
+
+    paths_ = paths;
+    matcher_params_ = matcher_params;
+    nstripes_ = nstripes;
+    timeout_ = timeout;
+    shards_.resize(std::min< std::size_t >(nshards, std::max< std::size_t >(paths.size(), 1)));
+    for (std::size_t i = 0; i < paths_.size(); ++i) {
+      shards_[i % shards_.size()].indices.push_back(i);
+    }
+    startZygote();
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+      spawn(i);
+    }
+  }
+
+  // terminate all workers and the zygote
+  void stop() {
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+      terminate(i);
+    }
+    shards_.clear();
+    stopZygote();
+  }
+
+  std::size_t size() const { return paths_.size(); }
+
+  std::size_t numShards() const { return shards_.size(); }
+
+  bool isAlive(const std::size_t shard) const { return shards_[shard].pid > 0; }
+
+  // match the source to all references.
+  // outputs are in the same shape as ResultMatcher::parallelMatch() over references in the order
+  // of paths given to start(). references in a failed shard have no matches.
+  // if top_k > 0, only matches to the top_k references with most matches are kept.
+  void parallelMatch(const Results &source, std::vector< cv::Matx33f > &transforms,
+                     std::vector< std::vector< cv::DMatch > > &matches_array,
+                     const std::vector< double > &min_match_ratios = std::vector< double >(),
+                     const int top_k = 0) {
+    CV_Assert(min_match_ratios.empty() || paths_.size() == min_match_ratios.size());
+
+    // initiate output
+    transforms.assign(paths_.size(), cv::Matx33f::eye());
+    matches_array.assign(paths_.size(), std::vector< cv::DMatch >());
+
+    // the request is sent as raw bytes of keypoints and descriptors,
+    // which must be continuous
+    const cv::Mat descriptors(source.descriptors.isContinuous() ? source.descriptors
+                                                                : source.descriptors.clone());
+
+    // respawn crashed workers, and wait for workers which are still loading
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+      if (shards_[i].pid <= 0) {
+        spawn(i);
+      }
+      if (shards_[i].pid > 0 && !shards_[i].ready) {
+        std::string ready;
+        shards_[i].ready = receiveMessage(shards_[i].fd, ready, deadline()) && ready == "ready";
+        if (!shards_[i].ready) {
+          std::cerr << "ShardedMatcher: shard " << i << " failed to load" << std::endl;
+          terminate(i);
+        }
+      }
+    }
+
+    // fan out the request. workers match concurrently.
+    std::vector< bool > sent(shards_.size(), false);
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+      if (shards_[i].pid <= 0) {
+        continue;
+      }
+      sent[i] = sendRequest(shards_[i].fd, source, descriptors, min_match_ratios);
+      if (!sent[i]) {
+        std::cerr << "ShardedMatcher: could not send a request to shard " << i << std::endl;
+        terminate(i);
+      }
+    }
+
+    // gather replies. the deadline is common to all shards because they work concurrently.
+    const double reply_deadline(deadline());
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+      if (!sent[i]) {
+        continue;
+      }
+      if (!receiveReply(shards_[i].fd, shards_[i].indices, transforms, matches_array,
+                        reply_deadline)) {
+        std::cerr << "ShardedMatcher: shard " << i << " failed or timed out" << std::endl;
+        terminate(i);
+      }
+    }
+
+    // drop all but the top-k references
+    if (top_k > 0 && static_cast< std::size_t >(top_k) < paths_.size()) {
+      std::vector< std::pair< std::size_t, std::size_t > > ranks; // (n_matches, index)
+      for (std::size_t i = 0; i < matches_array.size(); ++i) {
+        ranks.push_back(std::make_pair(matches_array[i].size(), i));
+      }
+      std::partial_sort(ranks.begin(), ranks.begin() + top_k, ranks.end(),
+                        std::greater< std::pair< std::size_t, std::size_t > >());
+      for (std::size_t i = top_k; i < ranks.size(); ++i) {
+        transforms[ranks[i].second] = cv::Matx33f::eye();
+        matches_array[ranks[i].second].clear();
+      }
+    }
+  }
+
+private:
+  struct Shard {
+    Shard() : pid(-1), fd(-1), ready(false) {}
+    std::vector< std::size_t > indices; // indices of references in the shard
+    pid_t pid;
+    int fd;
+    bool ready; // true if the worker has loaded the shard
+  };
+
+  //
+  // process management
+  //
+
+  // fork the zygote while the front end has no threads
+  void startZygote() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      CV_Error(cv::Error::StsError,
+               "ShardedMatcher: could not create a socket pair for the zygote");
+    }
+
+    const pid_t pid(fork());
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      CV_Error(cv::Error::StsError, "ShardedMatcher: could not fork the zygote");
+    }
+
+    if (pid == 0) {
+      // in the zygote. serve spawn requests and never return.
+      close(fds[0]);
+      int status(EXIT_SUCCESS);
+      try {
+        serveZygote(fds[1]);
+      } catch (const std::exception &error) {
+        std::cerr << "ShardedMatcher: zygote: " << error.what() << std::endl;
+        status = EXIT_FAILURE;
+      }
+      // skip destructors and exit handlers inherited from the front end
+      _exit(status);
+    }
+
+    close(fds[1]);
+    zygote_pid_ = pid;
+    zygote_fd_ = fds[0];
+  }
+
+  void stopZygote() {
+    if (zygote_fd_ >= 0) {
+      // the zygote exits on the end of stream
+      close(zygote_fd_);
+      zygote_fd_ = -1;
+    }
+    if (zygote_pid_ > 0) {
+      ::kill(zygote_pid_, SIGTERM);
+      waitpid(zygote_pid_, NULL, 0);
+      zygote_pid_ = -1;
+    }
+  }
+
+  // ask the zygote to fork a worker for the shard
+  void spawn(const std::size_t i) {
+    Shard &shard(shards_[i]);
+    std::ostringstream request;
+    request << i;
+    boost::int64_t pid;
+    int fd;
+    if (zygote_fd_ < 0 || !sendMessage(zygote_fd_, request.str()) ||
+        !receiveDescriptor(zygote_fd_, pid, fd)) {
+      std::cerr << "ShardedMatcher: could not spawn a worker for shard " << i << std::endl;
+      return;
+    }
+    if (pid <= 0) {
+      std::cerr << "ShardedMatcher: the zygote could not fork a worker for shard " << i
+                << std::endl;
+      close(fd);
+      return;
+    }
+    shard.pid = pid;
+    shard.fd = fd;
+    shard.ready = false;
+  }
+
+  void terminate(const std::size_t i) {
+    Shard &shard(shards_[i]);
+    if (shard.fd >= 0) {
+      // the worker exits on the end of stream
+      close(shard.fd);
+      shard.fd = -1;
+    }
+    if (shard.pid > 0) {
+      // the worker is a child of the zygote, which reaps it
+      ::kill(shard.pid, SIGKILL);
+      shard.pid = -1;
+    }
+    shard.ready = false;
+  }
+
+  // the absolute deadline of a message in ticks, or a negative value for no limit
+  double deadline() const {
+    return timeout_ > 0. ? cv::getTickCount() + timeout_ * cv::getTickFrequency() : -1.;
+  }
+
+  //
+  // zygote
+  //
+
+  void serveZygote(const int fd) const {
+    // let the kernel reap workers
+    std::signal(SIGCHLD, SIG_IGN);
+
+    std::string request;
+    while (receiveMessage(fd, request)) {
+      const std::size_t i(std::strtoul(request.c_str(), NULL, 10));
+      CV_Assert(i < shards_.size());
+
+      int fds[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cerr << "ShardedMatcher: could not create a socket pair for shard " << i << std::endl;
+        sendDescriptor(fd, -1, fd);
+        continue;
+      }
+
+      const pid_t pid(fork());
+      if (pid == 0) {
+        // in the worker. serve and never return.
+        close(fd);
+        close(fds[0]);
+        std::signal(SIGCHLD, SIG_DFL);
+        const Shard &shard(shards_[i]);
+        std::vector< std::string > paths;
+        for (std::size_t j = 0; j < shard.indices.size(); ++j) {
+          paths.push_back(paths_[shard.indices[j]]);
+        }
+        int status(EXIT_SUCCESS);
+        try {
+          serve(fds[1], paths, shard.indices, matcher_params_, nstripes_);
+        } catch (const std::exception &error) {
+          std::cerr << "ShardedMatcher: worker for shard " << i << ": " << error.what()
+                    << std::endl;
+          status = EXIT_FAILURE;
+        }
+        _exit(status);
+      }
+
+      // hand the socket of the worker to the front end
+      close(fds[1]);
+      const bool sent(sendDescriptor(fd, pid, pid > 0 ? fds[0] : fd));
+      close(fds[0]);
+      if (!sent) {
+        break;
+      }
+    }
+    close(fd);
+  }
+
+  //
+  // worker
+  //
+
+  static void serve(const int fd, const std::vector< std::string > &paths,
+                    const std::vector< std::size_t > &indices,
+                    const cv::Ptr< const MatcherParameters > &matcher_params,
+                    const double nstripes) {
+    ReferenceSet references;
+    references.load(paths, matcher_params, nstripes);
+    const std::vector< cv::Ptr< const ResultMatcher > > matchers(references.getMatchers());
+    if (!sendMessage(fd, "ready")) {
+      close(fd);
+      return;
+    }
+
+    Results source;
+    std::vector< double > all_ratios;
+    while (receiveRequest(fd, source, all_ratios)) {
+      std::vector< double > min_match_ratios;
+      if (!all_ratios.empty()) {
+        for (std::size_t i = 0; i < indices.size(); ++i) {
+          min_match_ratios.push_back(all_ratios[indices[i]]);
+        }
+      }
+
+      // match
+      std::vector< cv::Matx33f > transforms;
+      std::vector< std::vector< cv::DMatch > > matches_array;
+      ResultMatcher::parallelMatch(matchers, source, transforms, matches_array, min_match_ratios,
+                                   nstripes);
+
+      // reply
+      if (!sendReply(fd, transforms, matches_array)) {
+        break;
+      }
+    }
+    close(fd);
+  }
+
+  //
+  // binary requests and replies. both ends are forks of one process,
+  // so keypoints, descriptors, transforms and matches are sent in their native layouts.
+  // each message is prefixed by its length like string messages.
+  //
+
+  struct RequestHeader {
+    boost::uint64_t nkeypoints;
+    boost::uint64_t nratios;
+    boost::int32_t rows, cols, type;
+    boost::int32_t normType;
+    double descriptorScale, descriptorOffset;
+  };
+
+  struct ReplyHeader {
+    boost::uint64_t nreferences;
+    boost::uint64_t nmatches; // in total of all references
+  };
+
+  // request: header, keypoints, descriptors (continuous) and min match ratios
+  static bool sendRequest(const int fd, const Results &source, const cv::Mat &descriptors,
+                          const std::vector< double > &ratios) {
+    CV_Assert(descriptors.empty() || descriptors.isContinuous());
+    RequestHeader header;
+    header.nkeypoints = source.keypoints.size();
+    header.nratios = ratios.size();
+    header.rows = descriptors.rows;
+    header.cols = descriptors.cols;
+    header.type = descriptors.type();
+    header.normType = source.normType;
+    header.descriptorScale = source.descriptorScale;
+    header.descriptorOffset = source.descriptorOffset;
+
+    const std::size_t keypoint_bytes(source.keypoints.size() * sizeof(cv::KeyPoint));
+    const std::size_t descriptor_bytes(descriptors.total() * descriptors.elemSize());
+    const std::size_t ratio_bytes(ratios.size() * sizeof(double));
+    const boost::uint64_t len(sizeof(header) + keypoint_bytes + descriptor_bytes + ratio_bytes);
+    return sendAll(fd, &len, sizeof(len)) && sendAll(fd, &header, sizeof(header)) &&
+           sendAll(fd, source.keypoints.empty() ? NULL : &source.keypoints[0], keypoint_bytes) &&
+           sendAll(fd, descriptors.data, descriptor_bytes) &&
+           sendAll(fd, ratios.empty() ? NULL : &ratios[0], ratio_bytes);
+  }
+
+  // returns false on the end of stream or a malformed request
+  static bool receiveRequest(const int fd, Results &source, std::vector< double > &ratios) {
+    boost::uint64_t len;
+    RequestHeader header;
+    if (!receiveAll(fd, &len, sizeof(len), -1.) || len < sizeof(header) ||
+        !receiveAll(fd, &header, sizeof(header), -1.)) {
+      return false;
+    }
+    const boost::uint64_t body_len(len - sizeof(header));
+    if (header.rows < 0 || header.cols < 0 || header.nkeypoints > body_len / sizeof(cv::KeyPoint) ||
+        header.nratios > body_len / sizeof(double)) {
+      return false;
+    }
+    const boost::uint64_t keypoint_bytes(header.nkeypoints * sizeof(cv::KeyPoint));
+    const boost::uint64_t descriptor_bytes(boost::uint64_t(header.rows) * header.cols *
+                                           CV_ELEM_SIZE(header.type));
+    const boost::uint64_t ratio_bytes(header.nratios * sizeof(double));
+    if (body_len != keypoint_bytes + descriptor_bytes + ratio_bytes) {
+      return false;
+    }
+
+    source.keypoints.resize(header.nkeypoints);
+    source.descriptors.create(header.rows, header.cols, header.type);
+    ratios.resize(header.nratios);
+    source.normType = header.normType;
+    source.descriptorScale = header.descriptorScale;
+    source.descriptorOffset = header.descriptorOffset;
+    return receiveAll(fd, source.keypoints.empty() ? NULL : &source.keypoints[0], keypoint_bytes,
+                      -1.) &&
+           receiveAll(fd, source.descriptors.data, descriptor_bytes, -1.) &&
+           receiveAll(fd, ratios.empty() ? NULL : &ratios[0], ratio_bytes, -1.);
+  }
+
+  // reply: header, transforms, numbers of matches, and matches of all references
+  static bool sendReply(const int fd, const std::vector< cv::Matx33f > &transforms,
+                        const std::vector< std::vector< cv::DMatch > > &matches_array) {
+    CV_Assert(transforms.size() == matches_array.size());
+    std::vector< boost::uint64_t > nmatches(matches_array.size());
+    ReplyHeader header;
+    header.nreferences = matches_array.size();
+    header.nmatches = 0;
+    for (std::size_t i = 0; i < matches_array.size(); ++i) {
+      nmatches[i] = matches_array[i].size();
+      header.nmatches += nmatches[i];
+    }
+
+    const boost::uint64_t len(sizeof(header) +
+                              header.nreferences *
+                                  (sizeof(cv::Matx33f) + sizeof(boost::uint64_t)) +
+                              header.nmatches * sizeof(cv::DMatch));
+    if (!sendAll(fd, &len, sizeof(len)) || !sendAll(fd, &header, sizeof(header)) ||
+        !sendAll(fd, transforms.empty() ? NULL : &transforms[0],
+                 transforms.size() * sizeof(cv::Matx33f)) ||
+        !sendAll(fd, nmatches.empty() ? NULL : &nmatches[0],
+                 nmatches.size() * sizeof(boost::uint64_t))) {
+      return false;
+    }
+    for (std::size_t i = 0; i < matches_array.size(); ++i) {
+      if (!sendAll(fd, matches_array[i].empty() ? NULL : &matches_array[i][0],
+                   matches_array[i].size() * sizeof(cv::DMatch))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // fill outputs at the given indices. returns false if the reply is malformed or late,
+  // leaving the outputs at the indices without matches.
+  static bool receiveReply(const int fd, const std::vector< std::size_t > &indices,
+                           std::vector< cv::Matx33f > &transforms,
+                           std::vector< std::vector< cv::DMatch > > &matches_array,
+                           const double deadline) {
+    if (!receiveReplyBody(fd, indices, transforms, matches_array, deadline)) {
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        transforms[indices[i]] = cv::Matx33f::eye();
+        matches_array[indices[i]].clear();
+      }
+      return false;
+    }
+    return true;
+  }
+
+  static bool receiveReplyBody(const int fd, const std::vector< std::size_t > &indices,
+                               std::vector< cv::Matx33f > &transforms,
+                               std::vector< std::vector< cv::DMatch > > &matches_array,
+                               const double deadline) {
+    boost::uint64_t len;
+    ReplyHeader header;
+    if (!receiveAll(fd, &len, sizeof(len), deadline) || len < sizeof(header) ||
+        !receiveAll(fd, &header, sizeof(header), deadline) ||
+        header.nreferences != indices.size() ||
+        header.nmatches > (len - sizeof(header)) / sizeof(cv::DMatch) ||
+        len != sizeof(header) +
+                   header.nreferences * (sizeof(cv::Matx33f) + sizeof(boost::uint64_t)) +
+                   header.nmatches * sizeof(cv::DMatch)) {
+      return false;
+    }
+
+    std::vector< cv::Matx33f > shard_transforms(indices.size());
+    std::vector< boost::uint64_t > nmatches(indices.size());
+    if (!receiveAll(fd, shard_transforms.empty() ? NULL : &shard_transforms[0],
+                    shard_transforms.size() * sizeof(cv::Matx33f), deadline) ||
+        !receiveAll(fd, nmatches.empty() ? NULL : &nmatches[0],
+                    nmatches.size() * sizeof(boost::uint64_t), deadline)) {
+      return false;
+    }
+    boost::uint64_t total(0);
+    for (std::size_t i = 0; i < nmatches.size(); ++i) {
+      if (nmatches[i] > header.nmatches - total) {
+        return false;
+      }
+      total += nmatches[i];
+    }
+    if (total != header.nmatches) {
+      return false;
+    }
+
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+      transforms[indices[i]] = shard_transforms[i];
+      std::vector< cv::DMatch > &matches(matches_array[indices[i]]);
+      matches.resize(nmatches[i]);
+      if (!receiveAll(fd, matches.empty() ? NULL : &matches[0],
+                      matches.size() * sizeof(cv::DMatch), deadline)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //
+  // length-prefixed messages over a stream socket
+  //
+
+  static bool sendMessage(const int fd, const std::string &message) {
+    const boost::uint64_t len(message.size());
+    return sendAll(fd, &len, sizeof(len)) && sendAll(fd, message.data(), message.size());
+  }
+
+  // deadline: in ticks of cv::getTickCount(), or a negative value for no limit
+  static bool receiveMessage(const int fd, std::string &message, const double deadline = -1.) {
+    boost::uint64_t len;
+    if (!receiveAll(fd, &len, sizeof(len), deadline)) {
+      return false;
+    }
+    message.resize(len);
+    return len == 0 || receiveAll(fd, &message[0], len, deadline);
+  }
+
+  static bool sendAll(const int fd, const void *data, std::size_t len) {
+    const char *p(static_cast< const char * >(data));
+    while (len > 0) {
+      // MSG_NOSIGNAL avoids SIGPIPE when the peer has died
+      const ssize_t n(send(fd, p, len, MSG_NOSIGNAL));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  static bool receiveAll(const int fd, void *data, std::size_t len, const double deadline) {
+    char *p(static_cast< char * >(data));
+    while (len > 0) {
+      if (deadline >= 0. && !waitReadable(fd, deadline)) {
+        return false;
+      }
+      const ssize_t n(recv(fd, p, len, 0));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  // wait until the socket is readable or the deadline passes
+  static bool waitReadable(const int fd, const double deadline) {
+    while (true) {
+      const double remaining_ms((deadline - cv::getTickCount()) * 1000. / cv::getTickFrequency());
+      if (remaining_ms <= 0.) {
+        return false;
+      }
+      pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      const int n(poll(&pfd, 1, static_cast< int >(std::min(remaining_ms + 1., 1e9))));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      // readable, hung up or errored. recv() tells which.
+      return n > 0;
+    }
+  }
+
+  //
+  // a file descriptor with a process id over a Unix domain socket
+  //
+
+  static bool sendDescriptor(const int fd, const boost::int64_t pid, const int passed_fd) {
+    boost::int64_t payload(pid);
+    iovec iov;
+    iov.iov_base = &payload;
+    iov.iov_len = sizeof(payload);
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    msghdr msg = msghdr();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *const cmsg(CMSG_FIRSTHDR(&msg));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+    while (true) {
+      const ssize_t n(sendmsg(fd, &msg, MSG_NOSIGNAL));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return n == static_cast< ssize_t >(sizeof(payload));
+    }
+  }
+
+  static bool receiveDescriptor(const int fd, boost::int64_t &pid, int &passed_fd) {
+    boost::int64_t payload;
+    iovec iov;
+    iov.iov_base = &payload;
+    iov.iov_len = sizeof(payload);
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg = msghdr();
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+      n = recvmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    const cmsghdr *const cmsg(n > 0 ? CMSG_FIRSTHDR(&msg) : NULL);
+    if (n != static_cast< ssize_t >(sizeof(payload)) || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+      return false;
+    }
+    pid = payload;
+    std::memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(int));
+    return true;
+  }
+
+private:
+  std::vector< std::string > paths_;
+  cv::Ptr< const MatcherParameters > matcher_params_;
+  double nstripes_;
+  double timeout_;
+  std::vector< Shard > shards_;
+  pid_t zygote_pid_;
+  int zygote_fd_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
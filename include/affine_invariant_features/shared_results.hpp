@@ -0,0 +1,405 @@
+#ifndef AFFINE_INVARIANT_FEATURES_SHARED_RESULTS
+#define AFFINE_INVARIANT_FEATURES_SHARED_RESULTS
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Ring buffer of Results in POSIX shared memory, which hands extraction results
+// from a producer process to consumer processes without serialization.
+// A consumer maps keypoints and descriptors of a frame directly,
+// so the handoff cost does not depend on the number of descriptors.
+//
+// Each slot has a sequence number which is odd while the producer is writing to it.
+// A consumer can check if its view has been overwritten by the producer
+// (i.e. the consumer lags more than the number of slots) via SharedResultsView::valid().
+//
+// The mutex in the shared memory is not robust. Every lock is taken with a timeout so that
+// a process which died holding it does not block the others forever.
+// A restarted producer creates a new buffer with the next generation number
+// and marks the old one as replaced, on which consumers reopen the buffer by name.
+//
+
+namespace shared_results_detail {
+
+namespace bi = boost::interprocess;
+
+static const boost::uint64_t MAGIC = 0x4149465245534c54ULL; // "AIFRESLT"
+
+static const int LOCK_TIMEOUT_MS = 5000;
+static const int WAIT_SLICE_MS = 100;
+
+typedef bi::scoped_lock< bi::interprocess_mutex > Lock;
+
+static std::size_t alignUp(const std::size_t size) { return (size + 63) & ~std::size_t(63); }
+
+static boost::posix_time::ptime deadline(const int timeout_ms) {
+  return boost::posix_time::microsec_clock::universal_time() +
+         boost::posix_time::milliseconds(timeout_ms);
+}
+
+// magic is set by the producer after the header has been initialized
+struct Header {
+  Header(const int nslots_, const std::size_t slot_bytes_, const boost::uint64_t generation_)
+      : magic(0), generation(generation_), replaced(0), nslots(nslots_),
+        slot_bytes(slot_bytes_), latest(0) {}
+
+  volatile boost::uint64_t magic;
+  boost::uint64_t generation; // incremented every time a producer (re)creates the buffer
+  volatile int replaced;      // nonzero once a newer producer has created a new buffer
+  int nslots;
+  std::size_t slot_bytes;
+  boost::uint64_t latest; // sequence number of the last committed frame (0 if none)
+  bi::interprocess_mutex mutex;
+  bi::interprocess_condition committed;
+};
+
+struct Slot {
+  boost::uint64_t seq; // odd while being written
+  int nkeypoints;
+  int rows, cols, type;
+  int normType;
+  double descriptorScale;
+  double descriptorOffset;
+};
+
+static std::size_t regionSize(const int nslots, const std::size_t slot_bytes) {
+  return alignUp(sizeof(Header)) + nslots * (alignUp(sizeof(Slot)) + alignUp(slot_bytes));
+}
+
+static Header *header(void *base) { return static_cast< Header * >(base); }
+
+static Slot *slot(void *base, const int i) {
+  const Header *const h(header(base));
+  return reinterpret_cast< Slot * >(static_cast< char * >(base) + alignUp(sizeof(Header)) +
+                                    i * (alignUp(sizeof(Slot)) + alignUp(h->slot_bytes)));
+}
+
+static char *slotData(Slot *s) { return reinterpret_cast< char * >(s) + alignUp(sizeof(Slot)); }
+
+// returns false if the lock could not be taken in LOCK_TIMEOUT_MS,
+// which means another process has died holding it (or is stuck)
+static bool timedLock(Lock &lock) { return lock.timed_lock(deadline(LOCK_TIMEOUT_MS)); }
+
+static void lockOrThrow(Lock &lock) {
+  if (!timedLock(lock)) {
+    CV_Error(cv::Error::StsError,
+             "Could not lock the shared results buffer. A process may have died holding it.");
+  }
+}
+
+// open the buffer by name. returns an empty pointer if the buffer does not exist
+// or its producer has not finished initializing it.
+static cv::Ptr< bi::mapped_region > open(const std::string &name) {
+  try {
+    bi::shared_memory_object shm(bi::open_only, name.c_str(), bi::read_write);
+    bi::offset_t size;
+    if (!shm.get_size(size) || size < bi::offset_t(sizeof(Header))) {
+      return cv::Ptr< bi::mapped_region >();
+    }
+    cv::Ptr< bi::mapped_region > region(new bi::mapped_region(shm, bi::read_write));
+    if (header(region->get_address())->magic != MAGIC) {
+      return cv::Ptr< bi::mapped_region >();
+    }
+    return region;
+  } catch (const bi::interprocess_exception &) {
+    return cv::Ptr< bi::mapped_region >();
+  }
+}
+
+} // namespace shared_results_detail
+
+//
+// A frame mapped from the shared memory. Valid until the producer overwrites the slot.
+// The view keeps the mapping alive, but keypoints and descriptors may be overwritten
+// at any time, so copy them out via toResults() before using them for long.
+//
+
+class SharedResultsView {
+public:
+  SharedResultsView()
+      : generation(0), seq(0), keypoints(NULL), nkeypoints(0), normType(cv::NORM_L2),
+        descriptorScale(1.), descriptorOffset(0.), slot_(NULL) {}
+
+  // true if the frame has not been overwritten since it was mapped
+  // (false also if the buffer could not be locked)
+  bool valid() const {
+    namespace sd = shared_results_detail;
+    if (!region_ || !slot_) {
+      return false;
+    }
+    sd::Header *const h(sd::header(region_->get_address()));
+    sd::Lock lock(h->mutex, sd::bi::defer_lock);
+    if (!sd::timedLock(lock)) {
+      return false;
+    }
+    return slot_->seq == seq;
+  }
+
+  // copy the frame into results which do not refer to the shared memory.
+  // returns false if the frame was overwritten during the copy (results are then garbage).
+  bool toResults(Results &results) const {
+    results.keypoints.assign(keypoints, keypoints + nkeypoints);
+    results.descriptors = descriptors.clone();
+    results.normType = normType;
+    results.descriptorScale = descriptorScale;
+    results.descriptorOffset = descriptorOffset;
+    return valid();
+  }
+
+public:
+  boost::uint64_t generation;
+  boost::uint64_t seq;
+  const cv::KeyPoint *keypoints;
+  int nkeypoints;
+  cv::Mat descriptors; // header on the shared memory. do not modify.
+  int normType;
+  double descriptorScale;
+  double descriptorOffset;
+
+private:
+  friend class SharedResultsReader;
+  cv::Ptr< shared_results_detail::bi::mapped_region > region_;
+  shared_results_detail::Slot *slot_;
+};
+
+//
+// Producer side. Creates (or replaces) the shared memory and removes it on destruction.
+//
+
+class SharedResultsWriter {
+public:
+  // a slot being written. fill keypoints and descriptors, and then pass it to commit().
+  struct Frame {
+    Frame() : keypoints(NULL), nkeypoints(0), slot(-1) {}
+    cv::KeyPoint *keypoints;
+    int nkeypoints;
+    cv::Mat descriptors; // header on the shared memory
+    int slot;
+  };
+
+public:
+  // slot_bytes is the capacity of each slot for keypoints and descriptors of a frame
+  SharedResultsWriter(const std::string &name, const int nslots, const std::size_t slot_bytes)
+      : name_(name), next_(1) {
+    namespace sd = shared_results_detail;
+    CV_Assert(nslots > 0);
+
+    // take over from a previous producer. consumers still mapping its buffer
+    // see the replaced flag (without locking, as the producer may have died holding the lock)
+    // and reopen the new buffer.
+    boost::uint64_t generation(1);
+    const cv::Ptr< sd::bi::mapped_region > old_region(sd::open(name_));
+    if (old_region) {
+      sd::Header *const old_h(sd::header(old_region->get_address()));
+      generation = old_h->generation + 1;
+      old_h->replaced = 1;
+      old_h->committed.notify_all();
+    }
+
+    sd::bi::shared_memory_object::remove(name_.c_str());
+    sd::bi::shared_memory_object shm(sd::bi::create_only, name_.c_str(), sd::bi::read_write);
+    shm.truncate(sd::regionSize(nslots, slot_bytes));
+    region_ = new sd::bi::mapped_region(shm, sd::bi::read_write);
+
+    void *const base(region_->get_address());
+    sd::Header *const h(new (base) sd::Header(nslots, slot_bytes, generation));
+    for (int i = 0; i < nslots; ++i) {
+      std::memset(sd::slot(base, i), 0, sizeof(sd::Slot));
+    }
+    h->magic = sd::MAGIC;
+  }
+
+  virtual ~SharedResultsWriter() {
+    region_.release();
+    shared_results_detail::bi::shared_memory_object::remove(name_.c_str());
+  }
+
+  // reserve the oldest slot for a frame. the slot is invalidated for consumers.
+  // returns false if the frame does not fit the slot.
+  bool allocate(const int nkeypoints, const int rows, const int cols, const int type,
+                Frame &frame) {
+    namespace sd = shared_results_detail;
+    void *const base(region_->get_address());
+    sd::Header *const h(sd::header(base));
+
+    const std::size_t keypoint_bytes(sd::alignUp(nkeypoints * sizeof(cv::KeyPoint)));
+    const std::size_t descriptor_bytes(std::size_t(rows) * cols * CV_ELEM_SIZE(type));
+    if (keypoint_bytes + descriptor_bytes > h->slot_bytes) {
+      return false;
+    }
+
+    frame.slot = (next_ - 1) % h->nslots;
+    sd::Slot *const s(sd::slot(base, frame.slot));
+    {
+      sd::Lock lock(h->mutex, sd::bi::defer_lock);
+      sd::lockOrThrow(lock);
+      s->seq = 2 * next_ - 1;
+    }
+
+    char *const data(sd::slotData(s));
+    frame.keypoints = reinterpret_cast< cv::KeyPoint * >(data);
+    frame.nkeypoints = nkeypoints;
+    frame.descriptors = cv::Mat(rows, cols, type, data + keypoint_bytes);
+    return true;
+  }
+
+  // publish the frame to consumers
+  void commit(const Frame &frame, const int normType, const double descriptorScale = 1.,
+              const double descriptorOffset = 0.) {
+    namespace sd = shared_results_detail;
+    void *const base(region_->get_address());
+    sd::Header *const h(sd::header(base));
+    sd::Slot *const s(sd::slot(base, frame.slot));
+
+    sd::Lock lock(h->mutex, sd::bi::defer_lock);
+    sd::lockOrThrow(lock);
+    s->nkeypoints = frame.nkeypoints;
+    s->rows = frame.descriptors.rows;
+    s->cols = frame.descriptors.cols;
+    s->type = frame.descriptors.type();
+    s->normType = normType;
+    s->descriptorScale = descriptorScale;
+    s->descriptorOffset = descriptorOffset;
+    s->seq = 2 * next_;
+    h->latest = s->seq;
+    ++next_;
+    h->committed.notify_all();
+  }
+
+  // copy the results into a slot and publish them. returns false if they do not fit the slot.
+  bool write(const Results &results) {
+    Frame frame;
+    if (!allocate(results.keypoints.size(), results.descriptors.rows, results.descriptors.cols,
+                  results.descriptors.type(), frame)) {
+      return false;
+    }
+    std::copy(results.keypoints.begin(), results.keypoints.end(), frame.keypoints);
+    results.descriptors.copyTo(frame.descriptors);
+    commit(frame, results.normType, results.descriptorScale, results.descriptorOffset);
+    return true;
+  }
+
+private:
+  const std::string name_;
+  cv::Ptr< shared_results_detail::bi::mapped_region > region_;
+  boost::uint64_t next_; // index of the next frame (1-based)
+};
+
+//
+// Consumer side. Opens the shared memory created by a SharedResultsWriter,
+// and follows it when the producer is restarted.
+//
+
+class SharedResultsReader {
+public:
+  SharedResultsReader(const std::string &name) : name_(name), generation_(0), last_(0) {
+    region_ = shared_results_detail::open(name_);
+    if (!region_) {
+      CV_Error_(cv::Error::StsError, ("%s is not a shared results buffer", name_.c_str()));
+    }
+    generation_ = shared_results_detail::header(region_->get_address())->generation;
+  }
+
+  virtual ~SharedResultsReader() {}
+
+  // map the latest frame newer than the last read one.
+  // waits up to timeout_ms (forever if negative). returns false on timeout.
+  bool read(SharedResultsView &view, const int timeout_ms = -1) {
+    namespace sd = shared_results_detail;
+    const boost::posix_time::ptime deadline(sd::deadline(std::max(timeout_ms, 0)));
+
+    // wait in short slices to notice a replaced buffer
+    // even if the notification from the new producer has been missed
+    while (true) {
+      reopenIfReplaced();
+      sd::Header *const h(sd::header(region_->get_address()));
+      sd::Lock lock(h->mutex, sd::bi::defer_lock);
+      sd::lockOrThrow(lock);
+      if (h->latest > last_) {
+        map(view);
+        return true;
+      }
+      boost::posix_time::ptime slice(sd::deadline(sd::WAIT_SLICE_MS));
+      if (timeout_ms >= 0 && deadline < slice) {
+        slice = deadline;
+      }
+      if (!h->committed.timed_wait(lock, slice) && timeout_ms >= 0 &&
+          boost::posix_time::microsec_clock::universal_time() >= deadline) {
+        return false;
+      }
+    }
+  }
+
+private:
+  // switch to the buffer of a restarted producer. frames in the new buffer are all new.
+  void reopenIfReplaced() {
+    namespace sd = shared_results_detail;
+    if (!sd::header(region_->get_address())->replaced) {
+      return;
+    }
+    // the new producer may be still initializing its buffer. keep the old one until then.
+    const cv::Ptr< sd::bi::mapped_region > region(sd::open(name_));
+    if (!region) {
+      return;
+    }
+    const boost::uint64_t generation(sd::header(region->get_address())->generation);
+    if (generation == generation_) {
+      return;
+    }
+    region_ = region;
+    generation_ = generation;
+    last_ = 0;
+  }
+
+  // map the latest frame. the buffer must be locked.
+  void map(SharedResultsView &view) {
+    namespace sd = shared_results_detail;
+    void *const base(region_->get_address());
+    sd::Header *const h(sd::header(base));
+
+    // the slot of the latest frame. sequence number 2n is the n-th frame (1-based).
+    last_ = h->latest;
+    sd::Slot *const s(sd::slot(base, (last_ / 2 - 1) % h->nslots));
+    char *const data(sd::slotData(s));
+    const std::size_t keypoint_bytes(sd::alignUp(s->nkeypoints * sizeof(cv::KeyPoint)));
+
+    view.generation = generation_;
+    view.seq = s->seq;
+    view.keypoints = reinterpret_cast< const cv::KeyPoint * >(data);
+    view.nkeypoints = s->nkeypoints;
+    view.descriptors = cv::Mat(s->rows, s->cols, s->type, data + keypoint_bytes);
+    view.normType = s->normType;
+    view.descriptorScale = s->descriptorScale;
+    view.descriptorOffset = s->descriptorOffset;
+    view.region_ = region_;
+    view.slot_ = s;
+  }
+
+private:
+  const std::string name_;
+  cv::Ptr< shared_results_detail::bi::mapped_region > region_;
+  boost::uint64_t generation_; // generation of the mapped buffer
+  boost::uint64_t last_;       // sequence number of the last read frame
+};
+
+} // namespace affine_invariant_features
+
+#endif
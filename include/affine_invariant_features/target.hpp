@@ -1,14 +1,12 @@
 #ifndef AFFINE_INVARIANT_FEATURES_TARGET
 #define AFFINE_INVARIANT_FEATURES_TARGET
 
-#include <fstream>
-#include <iomanip>
-#include <sstream>
 #include <string>
 #include <vector>
 
 #include <ros/package.h>
 
+#include <affine_invariant_features/content_hash.hpp>
 #include <affine_invariant_features/cv_serializable.hpp>
 
 #include <boost/filesystem.hpp>
@@ -17,20 +15,24 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
-#include <openssl/md5.h>
-
 namespace affine_invariant_features {
 
 struct TargetDescription : public CvSerializable {
 public:
-  TargetDescription() {}
+  TargetDescription() : hashType("md5") {}
 
   virtual ~TargetDescription() {}
 
   virtual void read(const cv::FileNode &fn) {
     fn["package"] >> package;
     fn["path"] >> path;
-    fn["md5"] >> md5;
+    fn["hashType"] >> hashType;
+    fn["hash"] >> hash;
+    if (hashType.empty() && hash.empty()) {
+      // old files only have a MD5 hash
+      hashType = "md5";
+      fn["md5"] >> hash;
+    }
     const cv::FileNode contour_node(fn["contour"]);
     const std::size_t contour_size(contour_node.isSeq() ? contour_node.size() : 0);
     contour.resize(contour_size);
@@ -42,7 +44,8 @@ public:
   virtual void write(cv::FileStorage &fs) const {
     fs << "package" << package;
     fs << "path" << path;
-    fs << "md5" << md5;
+    fs << "hashType" << hashType;
+    fs << "hash" << hash;
     fs << "contour";
     fs << "[:";
     for (std::vector< cv::Point >::const_iterator point = contour.begin(); point != contour.end();
@@ -67,38 +70,24 @@ public:
     return (root_path / leaf_path).string();
   }
 
-  static std::string generateMD5(const std::string &path) {
-    // open the file path as a binary file
-    std::ifstream ifs(path.c_str(), std::ios::binary);
-    if (!ifs) {
-      return std::string();
-    }
-
-    // calculate the MD5 hash using openSSL library
-    unsigned char md5[MD5_DIGEST_LENGTH];
-    {
-      MD5_CTX ctx;
-      MD5_Init(&ctx);
-      char buf[4096];
-      while (ifs.read(buf, 4096) || ifs.gcount()) {
-        MD5_Update(&ctx, buf, ifs.gcount());
-      }
-      MD5_Final(md5, &ctx);
-    }
+  // hash the file content with the given type ("md5" or "xxh64").
+  // the hash is cached until the file is modified.
+  static std::string generateHash(const std::string &path, const std::string &type) {
+    return ContentHash::generate(path, type);
+  }
 
-    // stringaze the MD5 hash
-    std::ostringstream oss;
-    for (int i = 0; i < MD5_DIGEST_LENGTH; ++i) {
-      oss << std::hex << std::setw(2) << std::setfill('0') << static_cast< int >(md5[i]);
-    }
+  static std::string generateMD5(const std::string &path) { return generateHash(path, "md5"); }
 
-    return oss.str();
+  // true if the described file has the hash
+  bool verifyHash() const {
+    return !hash.empty() && hash == generateHash(resolvePath(package, path), hashType);
   }
 
 public:
   std::string package;
   std::string path;
-  std::string md5;
+  std::string hashType; // "md5" or "xxh64"
+  std::string hash;
   std::vector< cv::Point > contour;
 };
 
@@ -122,16 +111,14 @@ public:
 
 public:
   static cv::Ptr< TargetData > retrieve(const TargetDescription &desc,
-                                        const bool check_md5 = false) {
+                                        const bool check_hash = false) {
     const std::string path(TargetDescription::resolvePath(desc.package, desc.path));
     if (path.empty()) {
       return cv::Ptr< TargetData >();
     }
 
-    if (check_md5) {
-      if (desc.md5.empty() || desc.md5 != TargetDescription::generateMD5(path)) {
-        return cv::Ptr< TargetData >();
-      }
+    if (check_hash && !desc.verifyHash()) {
+      return cv::Ptr< TargetData >();
     }
 
     const cv::Ptr< TargetData > data(new TargetData());
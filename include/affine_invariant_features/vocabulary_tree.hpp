@@ -0,0 +1,494 @@
+#ifndef AFFINE_INVARIANT_FEATURES_VOCABULARY_TREE
+#define AFFINE_INVARIANT_FEATURES_VOCABULARY_TREE
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/cv_serializable.hpp>
+#include <affine_invariant_features/parallel_tasks.hpp>
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+#include <opencv2/core.hpp>
+
+namespace affine_invariant_features {
+
+//
+// Hierarchical k-means tree which quantizes a descriptor into a visual word
+// by descending to the nearest child from the root.
+// Descriptors are clustered in float. Binary descriptors are unpacked into bits
+// so that L2 distances between them are square roots of Hamming distances.
+//
+
+class VocabularyTree : public CvSerializable {
+public:
+  VocabularyTree(const int branching = 10, const int depth = 4)
+      : branching_(branching), depth_(depth), nwords_(0) {}
+
+  virtual ~VocabularyTree() {}
+
+  virtual void read(const cv::FileNode &fn) {
+    fn["branching"] >> branching_;
+    fn["depth"] >> depth_;
+    fn["centers"] >> centers_;
+    fn["firstChildren"] >> first_children_;
+    fn["numChildren"] >> nchildren_;
+    fn["words"] >> words_;
+    nwords_ = 0;
+    for (std::vector< int >::const_iterator word = words_.begin(); word != words_.end(); ++word) {
+      nwords_ = std::max(nwords_, *word + 1);
+    }
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    fs << "branching" << branching_;
+    fs << "depth" << depth_;
+    fs << "centers" << centers_;
+    fs << "firstChildren" << first_children_;
+    fs << "numChildren" << nchildren_;
+    fs << "words" << words_;
+  }
+
+  virtual std::string getDefaultName() const { return "VocabularyTree"; }
+
+  bool empty() const { return nwords_ == 0; }
+
+  int numWords() const { return nwords_; }
+
+  // dimension of features (i.e. the number of columns of the output of toFeatures())
+  int featureSize() const { return centers_.cols; }
+
+  // float features to be clustered or quantized
+  static void toFeatures(const Results &results, cv::Mat &features) {
+    const cv::Mat &descriptors(results.descriptors);
+    if (results.normType == cv::NORM_HAMMING || results.normType == cv::NORM_HAMMING2) {
+      CV_Assert(descriptors.depth() == CV_8U);
+      features.create(descriptors.rows, descriptors.cols * 8, CV_32FC1);
+      for (int i = 0; i < descriptors.rows; ++i) {
+        const uchar *const src(descriptors.ptr< uchar >(i));
+        float *const dst(features.ptr< float >(i));
+        for (int j = 0; j < descriptors.cols * 8; ++j) {
+          dst[j] = (src[j / 8] >> (7 - j % 8)) & 1;
+        }
+      }
+    } else if (results.isQuantized()) {
+      descriptors.convertTo(features, CV_32F, 1. / results.descriptorScale,
+                            results.descriptorOffset);
+    } else {
+      descriptors.convertTo(features, CV_32F);
+    }
+  }
+
+  // build the tree from float features (one per row) by recursive k-means
+  void train(const cv::Mat &features, const int max_iters = 10, const int attempts = 1) {
+    CV_Assert(features.type() == CV_32FC1 && features.rows > 0);
+    CV_Assert(branching_ > 1 && depth_ > 0);
+
+    centers_ = cv::Mat::zeros(1, features.cols, CV_32FC1);
+    first_children_.assign(1, -1);
+    nchildren_.assign(1, 0);
+    words_.assign(1, -1);
+    nwords_ = 0;
+
+    // split nodes in breadth-first order so that children of a node are contiguous
+    std::vector< std::vector< int > > members(1);
+    std::vector< int > levels(1, 0);
+    for (int i = 0; i < features.rows; ++i) {
+      members[0].push_back(i);
+    }
+    for (std::size_t node = 0; node < members.size(); ++node) {
+      if (levels[node] >= depth_ || static_cast< int >(members[node].size()) <= branching_) {
+        words_[node] = nwords_++;
+        std::vector< int >().swap(members[node]);
+        continue;
+      }
+
+      cv::Mat node_features(members[node].size(), features.cols, CV_32FC1);
+      for (std::size_t i = 0; i < members[node].size(); ++i) {
+        features.row(members[node][i]).copyTo(node_features.row(i));
+      }
+      cv::Mat labels, centers;
+      cv::kmeans(node_features, branching_, labels,
+                 cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, max_iters, 1e-4),
+                 attempts, cv::KMEANS_PP_CENTERS, centers);
+
+      first_children_[node] = centers_.rows;
+      nchildren_[node] = branching_;
+      centers_.push_back(centers);
+      for (int c = 0; c < branching_; ++c) {
+        first_children_.push_back(-1);
+        nchildren_.push_back(0);
+        words_.push_back(-1);
+        members.push_back(std::vector< int >());
+        levels.push_back(levels[node] + 1);
+      }
+      for (int i = 0; i < labels.rows; ++i) {
+        members[first_children_[node] + labels.at< int >(i)].push_back(members[node][i]);
+      }
+      std::vector< int >().swap(members[node]);
+    }
+  }
+
+  // visual word of a float feature
+  int quantize(const float *feature) const {
+    int node(0);
+    while (first_children_[node] >= 0) {
+      int nearest(first_children_[node]);
+      float min_dist(FLT_MAX);
+      for (int c = first_children_[node]; c < first_children_[node] + nchildren_[node]; ++c) {
+        const float dist(squaredDistance(feature, centers_.ptr< float >(c), centers_.cols));
+        if (dist < min_dist) {
+          min_dist = dist;
+          nearest = c;
+        }
+      }
+      node = nearest;
+    }
+    return words_[node];
+  }
+
+  // visual words of all features
+  void quantize(const cv::Mat &features, std::vector< int > &words) const {
+    CV_Assert(features.type() == CV_32FC1 && features.cols == centers_.cols);
+    words.resize(features.rows);
+    for (int i = 0; i < features.rows; ++i) {
+      words[i] = quantize(features.ptr< float >(i));
+    }
+  }
+
+private:
+  static float squaredDistance(const float *a, const float *b, const int size) {
+    float dist(0.f);
+    for (int i = 0; i < size; ++i) {
+      const float d(a[i] - b[i]);
+      dist += d * d;
+    }
+    return dist;
+  }
+
+private:
+  int branching_;
+  int depth_;
+  // nodes in breadth-first order. the root is the node 0 whose center is not used.
+  cv::Mat centers_;
+  std::vector< int > first_children_; // -1 for leaves
+  std::vector< int > nchildren_;
+  std::vector< int > words_; // -1 for internal nodes
+  int nwords_;
+};
+
+//
+// Inverted file from visual words to references with TF-IDF weights.
+// Each reference is represented by a L2-normalized bag of words weighted by TF-IDF,
+// and scored against a query by the dot product accumulated over the inverted lists.
+// Used to shortlist candidate references before geometric verification by ResultMatcher.
+//
+
+class InvertedIndex : public CvSerializable {
+public:
+  // (word, weight) in a bag of words
+  typedef std::pair< int, float > Entry;
+  // (reference, weight) in an inverted list
+  typedef std::pair< int, float > Posting;
+
+public:
+  InvertedIndex() : nreferences_(0) {}
+
+  virtual ~InvertedIndex() {}
+
+  virtual void read(const cv::FileNode &fn) {
+    vocabulary_.read(fn[vocabulary_.getDefaultName()]);
+    fn["idf"] >> idf_;
+    // bags of words in a compressed row storage, from which the inverted lists are rebuilt
+    std::vector< int > offsets, words;
+    std::vector< float > weights;
+    fn["offsets"] >> offsets;
+    fn["words"] >> words;
+    fn["weights"] >> weights;
+    CV_Assert(!offsets.empty() && words.size() == weights.size());
+    nreferences_ = offsets.size() - 1;
+    reference_ids_.clear();
+    fn["referenceIds"] >> reference_ids_;
+    CV_Assert(reference_ids_.empty() || static_cast< int >(reference_ids_.size()) == nreferences_);
+    inverted_lists_.assign(vocabulary_.numWords(), std::vector< Posting >());
+    for (int i = 0; i < nreferences_; ++i) {
+      for (int j = offsets[i]; j < offsets[i + 1]; ++j) {
+        inverted_lists_[words[j]].push_back(Posting(i, weights[j]));
+      }
+    }
+  }
+
+  virtual void write(cv::FileStorage &fs) const {
+    vocabulary_.save(fs);
+    fs << "idf" << idf_;
+    std::vector< std::vector< Entry > > bags(nreferences_);
+    for (std::size_t word = 0; word < inverted_lists_.size(); ++word) {
+      for (std::vector< Posting >::const_iterator posting = inverted_lists_[word].begin();
+           posting != inverted_lists_[word].end(); ++posting) {
+        bags[posting->first].push_back(Entry(word, posting->second));
+      }
+    }
+    std::vector< int > offsets(1, 0), words;
+    std::vector< float > weights;
+    for (std::size_t i = 0; i < bags.size(); ++i) {
+      for (std::vector< Entry >::const_iterator entry = bags[i].begin(); entry != bags[i].end();
+           ++entry) {
+        words.push_back(entry->first);
+        weights.push_back(entry->second);
+      }
+      offsets.push_back(words.size());
+    }
+    fs << "offsets" << offsets;
+    fs << "words" << words;
+    fs << "weights" << weights;
+    if (!reference_ids_.empty()) {
+      fs << "referenceIds" << reference_ids_;
+    }
+  }
+
+  virtual std::string getDefaultName() const { return "InvertedIndex"; }
+
+  bool empty() const { return nreferences_ == 0; }
+
+  int numReferences() const { return nreferences_; }
+
+  const VocabularyTree &getVocabulary() const { return vocabulary_; }
+
+  // identifiers of the indexed references (e.g. content hashes of their files),
+  // which are saved with the index so that a stale index can be detected on loading.
+  // empty if not set after build().
+  const std::vector< std::string > &getReferenceIds() const { return reference_ids_; }
+
+  void setReferenceIds(const std::vector< std::string > &ids) {
+    CV_Assert(static_cast< int >(ids.size()) == nreferences_);
+    reference_ids_ = ids;
+  }
+
+  // train the vocabulary on descriptors sampled from the references, and then index them.
+  // empty pointers are allowed and never shortlisted.
+  // descriptors are converted into float features one reference at a time
+  // (binary descriptors grow 32 times), so that all the features never exist at once.
+  void build(const std::vector< cv::Ptr< const Results > > &references, const int branching = 10,
+             const int depth = 4, const int max_samples = 100000) {
+    // train the vocabulary on evenly strided samples
+    std::size_t nfeatures(0);
+    for (std::size_t i = 0; i < references.size(); ++i) {
+      if (references[i]) {
+        nfeatures += references[i]->descriptors.rows;
+      }
+    }
+    CV_Assert(nfeatures > 0);
+    const std::size_t max_nsamples(std::max(max_samples, 1));
+    const std::size_t stride((nfeatures + max_nsamples - 1) / max_nsamples);
+    cv::Mat samples;
+    std::size_t count(0);
+    for (std::size_t i = 0; i < references.size(); ++i) {
+      if (!references[i]) {
+        continue;
+      }
+      Results sampled;
+      sampled.normType = references[i]->normType;
+      sampled.descriptorScale = references[i]->descriptorScale;
+      sampled.descriptorOffset = references[i]->descriptorOffset;
+      for (int j = 0; j < references[i]->descriptors.rows; ++j, ++count) {
+        if (count % stride == 0) {
+          sampled.descriptors.push_back(references[i]->descriptors.row(j));
+        }
+      }
+      if (!sampled.descriptors.empty()) {
+        cv::Mat features;
+        VocabularyTree::toFeatures(sampled, features);
+        samples.push_back(features);
+      }
+    }
+    vocabulary_ = VocabularyTree(branching, depth);
+    vocabulary_.train(samples);
+
+    // bags of words of all references in parallel
+    std::vector< std::vector< Entry > > bags(references.size());
+    ParallelTasks bag_tasks(references.size());
+    for (std::size_t i = 0; i < references.size(); ++i) {
+      bag_tasks[i] = boost::bind(&InvertedIndex::countReferenceWords, this,
+                                 boost::cref(references[i]), boost::ref(bags[i]));
+    }
+    cv::parallel_for_(cv::Range(0, bag_tasks.size()), bag_tasks);
+
+    // inverse document frequencies
+    nreferences_ = references.size();
+    reference_ids_.clear();
+    std::vector< int > frequencies(vocabulary_.numWords(), 0);
+    for (std::size_t i = 0; i < bags.size(); ++i) {
+      for (std::vector< Entry >::const_iterator entry = bags[i].begin(); entry != bags[i].end();
+           ++entry) {
+        ++frequencies[entry->first];
+      }
+    }
+    idf_.resize(frequencies.size());
+    for (std::size_t word = 0; word < frequencies.size(); ++word) {
+      idf_[word] =
+          frequencies[word] > 0 ? std::log(static_cast< float >(nreferences_) / frequencies[word])
+                                : 0.f;
+    }
+
+    // inverted lists of normalized TF-IDF weights
+    inverted_lists_.assign(vocabulary_.numWords(), std::vector< Posting >());
+    for (std::size_t i = 0; i < bags.size(); ++i) {
+      weigh(bags[i]);
+      for (std::vector< Entry >::const_iterator entry = bags[i].begin(); entry != bags[i].end();
+           ++entry) {
+        inverted_lists_[entry->first].push_back(Posting(i, entry->second));
+      }
+    }
+  }
+
+  // indices of the top-k references in descending order of the similarity to the source
+  // (references without any common words are never shortlisted)
+  void query(const Results &source, const int top_k, std::vector< int > &indices,
+             std::vector< float > *scores = NULL) const {
+    indices.clear();
+    if (scores) {
+      scores->clear();
+    }
+    if (empty() || source.descriptors.empty()) {
+      return;
+    }
+
+    cv::Mat features;
+    VocabularyTree::toFeatures(source, features);
+    std::vector< Entry > bag;
+    countWords(features, bag);
+    weigh(bag);
+
+    // accumulate dot products over the inverted lists
+    std::vector< float > similarities(nreferences_, 0.f);
+    for (std::vector< Entry >::const_iterator entry = bag.begin(); entry != bag.end(); ++entry) {
+      const std::vector< Posting > &postings(inverted_lists_[entry->first]);
+      for (std::vector< Posting >::const_iterator posting = postings.begin();
+           posting != postings.end(); ++posting) {
+        similarities[posting->first] += entry->second * posting->second;
+      }
+    }
+
+    // select the top-k
+    std::vector< std::pair< float, int > > ranks;
+    for (int i = 0; i < nreferences_; ++i) {
+      if (similarities[i] > 0.f) {
+        ranks.push_back(std::make_pair(similarities[i], i));
+      }
+    }
+    const std::size_t nranks(std::min(ranks.size(), static_cast< std::size_t >(top_k)));
+    std::partial_sort(ranks.begin(), ranks.begin() + nranks, ranks.end(),
+                      std::greater< std::pair< float, int > >());
+    for (std::size_t i = 0; i < nranks; ++i) {
+      indices.push_back(ranks[i].second);
+      if (scores) {
+        scores->push_back(ranks[i].first);
+      }
+    }
+  }
+
+  // match the source against only the top-k references shortlisted by query().
+  // outputs have the same shape as ResultMatcher::parallelMatch(),
+  // and entries of references not shortlisted are left empty.
+  void parallelMatch(const std::vector< cv::Ptr< const ResultMatcher > > &matchers,
+                     const Results &source, const int top_k,
+                     std::vector< cv::Matx33f > &transforms,
+                     std::vector< std::vector< cv::DMatch > > &matches_array,
+                     const std::vector< double > &min_match_ratios = std::vector< double >(),
+                     const double nstripes = -1.) const {
+    CV_Assert(static_cast< int >(matchers.size()) == nreferences_);
+    CV_Assert(min_match_ratios.empty() || matchers.size() == min_match_ratios.size());
+
+    transforms.assign(matchers.size(), cv::Matx33f::eye());
+    matches_array.assign(matchers.size(), std::vector< cv::DMatch >());
+
+    // gather the shortlisted matchers
+    std::vector< int > indices;
+    query(source, top_k, indices);
+    std::vector< cv::Ptr< const ResultMatcher > > shortlist;
+    std::vector< double > shortlist_ratios;
+    std::vector< int > shortlist_indices;
+    for (std::vector< int >::const_iterator i = indices.begin(); i != indices.end(); ++i) {
+      if (matchers[*i]) {
+        shortlist.push_back(matchers[*i]);
+        shortlist_ratios.push_back(min_match_ratios.empty() ? 0. : min_match_ratios[*i]);
+        shortlist_indices.push_back(*i);
+      }
+    }
+
+    // verify the shortlist, and then scatter the outputs
+    std::vector< cv::Matx33f > shortlist_transforms;
+    std::vector< std::vector< cv::DMatch > > shortlist_matches;
+    ResultMatcher::parallelMatch(shortlist, source, shortlist_transforms, shortlist_matches,
+                                 shortlist_ratios, nstripes);
+    for (std::size_t i = 0; i < shortlist_indices.size(); ++i) {
+      transforms[shortlist_indices[i]] = shortlist_transforms[i];
+      matches_array[shortlist_indices[i]].swap(shortlist_matches[i]);
+    }
+  }
+
+private:
+  // convert and quantize descriptors of a reference.
+  // the features are released as soon as the bag of words is counted.
+  void countReferenceWords(const cv::Ptr< const Results > &reference,
+                           std::vector< Entry > &bag) const {
+    bag.clear();
+    if (!reference || reference->descriptors.empty()) {
+      return;
+    }
+    cv::Mat features;
+    VocabularyTree::toFeatures(*reference, features);
+    countWords(features, bag);
+  }
+
+  // term frequencies as a sorted bag of words
+  void countWords(const cv::Mat &features, std::vector< Entry > &bag) const {
+    bag.clear();
+    if (features.empty()) {
+      return;
+    }
+    std::vector< int > words;
+    vocabulary_.quantize(features, words);
+    std::sort(words.begin(), words.end());
+    for (std::vector< int >::const_iterator word = words.begin(); word != words.end(); ++word) {
+      if (bag.empty() || bag.back().first != *word) {
+        bag.push_back(Entry(*word, 0.f));
+      }
+      bag.back().second += 1.f / words.size();
+    }
+  }
+
+  // multiply term frequencies by inverse document frequencies, and then normalize
+  void weigh(std::vector< Entry > &bag) const {
+    float sq_norm(0.f);
+    for (std::vector< Entry >::iterator entry = bag.begin(); entry != bag.end(); ++entry) {
+      entry->second *= idf_[entry->first];
+      sq_norm += entry->second * entry->second;
+    }
+    if (sq_norm > 0.f) {
+      const float norm(std::sqrt(sq_norm));
+      for (std::vector< Entry >::iterator entry = bag.begin(); entry != bag.end(); ++entry) {
+        entry->second /= norm;
+      }
+    }
+  }
+
+private:
+  VocabularyTree vocabulary_;
+  std::vector< float > idf_;
+  std::vector< std::vector< Posting > > inverted_lists_;
+  int nreferences_;
+  std::vector< std::string > reference_ids_;
+};
+
+} // namespace affine_invariant_features
+
+#endif
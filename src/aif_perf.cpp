@@ -0,0 +1,460 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/dense_feature.hpp>
+#include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/results.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <sys/resource.h>
+
+#include "aif_assert.hpp"
+
+namespace aif = affine_invariant_features;
+
+//
+// Measurements of a case of the workload
+//
+
+struct PerfCase {
+  PerfCase() : wallSeconds(0.), cpuSeconds(0.), processPeakRssKB(0), rate(0.), failed(false) {}
+
+  std::string name;
+  double wallSeconds; // median over repeats
+  double cpuSeconds;  // median over repeats, summed over all threads
+  // peak resident set size of the process so far, measured at the end of the case.
+  // this is cumulative over the cases run before, not the footprint of the case.
+  long processPeakRssKB;
+  std::string rateName;
+  double rate; // items (keypoints or matches) per wall second
+  bool failed; // true if the case threw. the error is recorded instead of measurements.
+  std::string error;
+};
+
+static double cpuSeconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec +
+         usage.ru_stime.tv_usec * 1e-6;
+}
+
+static long processPeakRssKB() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static double median(std::vector< double > values) {
+  std::sort(values.begin(), values.end());
+  return values.empty() ? 0. : values[values.size() / 2];
+}
+
+//
+// Deterministic workload
+//
+
+// random shapes on a smooth noisy background, which is same for the same seed
+static cv::Mat syntheticImage(const int seed, const int size) {
+  cv::RNG rng(seed);
+  cv::Mat image(size, size, CV_8UC1);
+  rng.fill(image, cv::RNG::UNIFORM, 0, 64);
+  cv::GaussianBlur(image, image, cv::Size(0, 0), 2.);
+  for (int i = 0; i < size / 4; ++i) {
+    const cv::Point center(rng.uniform(0, size), rng.uniform(0, size));
+    const int radius(rng.uniform(size / 80 + 1, size / 16 + 2));
+    const cv::Scalar color(rng.uniform(64, 256));
+    const int thickness(rng.uniform(0, 2) == 0 ? -1 : 2);
+    if (rng.uniform(0, 2) == 0) {
+      cv::circle(image, center, radius, color, thickness);
+    } else {
+      cv::rectangle(image, center - cv::Point(radius, radius), center + cv::Point(radius, radius),
+                    color, thickness);
+    }
+  }
+  return image;
+}
+
+// parameter sets of all registered types. AIFParameters wraps ORB to keep the workload short.
+static std::vector< cv::Ptr< aif::FeatureParameters > > allFeatureParameters() {
+  std::vector< cv::Ptr< aif::FeatureParameters > > params_array;
+  const std::vector< std::string > names(aif::getFeatureParameterNames());
+  for (std::vector< std::string >::const_iterator name = names.begin(); name != names.end();
+       ++name) {
+    const cv::Ptr< aif::FeatureParameters > params(aif::createFeatureParameters(*name));
+    const cv::Ptr< aif::AIFParameters > aif_params(params.dynamicCast< aif::AIFParameters >());
+    if (aif_params) {
+      aif_params->push_back(new aif::ORBParameters());
+    }
+    params_array.push_back(params);
+  }
+  return params_array;
+}
+
+// how a feature algorithm is run, which depends on whether it detects and/or extracts
+enum FeatureMode { DETECT_AND_COMPUTE, DETECT, COMPUTE };
+
+// the mode is fixed by the parameter type, so that a failure is never mistaken for a mode
+static FeatureMode featureMode(const aif::FeatureParameters &params) {
+  if (params.isDetector() && params.isExtractor()) {
+    return DETECT_AND_COMPUTE;
+  }
+  return params.isDetector() ? DETECT : COMPUTE;
+}
+
+static std::string modeName(const FeatureMode mode) {
+  switch (mode) {
+  case DETECT_AND_COMPUTE:
+    return "detectAndCompute";
+  case DETECT:
+    return "detect";
+  case COMPUTE:
+    return "compute";
+  }
+  return "";
+}
+
+static void runFeature(cv::Feature2D &feature, const FeatureMode mode, const cv::Mat &image,
+                       const std::vector< cv::KeyPoint > &grid_keypoints,
+                       std::vector< cv::KeyPoint > &keypoints, cv::Mat &descriptors) {
+  switch (mode) {
+  case DETECT_AND_COMPUTE:
+    feature.detectAndCompute(image, cv::noArray(), keypoints, descriptors);
+    break;
+  case DETECT:
+    feature.detect(image, keypoints);
+    break;
+  case COMPUTE:
+    keypoints = grid_keypoints;
+    feature.compute(image, keypoints, descriptors);
+    break;
+  }
+}
+
+static std::string extractionCaseName(const aif::FeatureParameters &params) {
+  return "extract/" + params.getDefaultName() + "/" + modeName(featureMode(params));
+}
+
+static PerfCase extractionCase(const aif::FeatureParameters &params, const cv::Mat &image,
+                               const int repeats) {
+  const FeatureMode mode(featureMode(params));
+  PerfCase perf;
+  perf.name = extractionCaseName(params);
+  perf.rateName = "keypointsPerSecond";
+
+  const cv::Ptr< cv::Feature2D > feature(params.createFeature());
+  if (!feature) {
+    perf.failed = true;
+    perf.error = "Could not create a feature algorithm";
+    return perf;
+  }
+
+  // keypoints for extractors which do not detect
+  std::vector< cv::KeyPoint > grid_keypoints;
+  aif::DenseFeatureDetector().detect(image, grid_keypoints);
+
+  // the first run is a warm-up
+  std::vector< double > walls, cpus;
+  std::size_t nkeypoints(0);
+  for (int i = 0; i < repeats + 1; ++i) {
+    std::vector< cv::KeyPoint > keypoints;
+    cv::Mat descriptors;
+    const double cpu_start(cpuSeconds());
+    const int64 tick(cv::getTickCount());
+    runFeature(*feature, mode, image, grid_keypoints, keypoints, descriptors);
+    if (i == 0) {
+      continue;
+    }
+    walls.push_back((cv::getTickCount() - tick) / cv::getTickFrequency());
+    cpus.push_back(cpuSeconds() - cpu_start);
+    nkeypoints = keypoints.size();
+  }
+
+  perf.wallSeconds = median(walls);
+  perf.cpuSeconds = median(cpus);
+  perf.processPeakRssKB = processPeakRssKB();
+  perf.rate = perf.wallSeconds > 0. ? nkeypoints / perf.wallSeconds : 0.;
+  return perf;
+}
+
+static cv::Ptr< aif::Results > extract(cv::Feature2D &feature, const cv::Mat &image) {
+  const cv::Ptr< aif::Results > results(new aif::Results());
+  feature.detectAndCompute(image, cv::noArray(), results->keypoints, results->descriptors);
+  results->normType = feature.defaultNorm();
+  return results;
+}
+
+static std::string matchingCaseName(const int nreferences) {
+  std::ostringstream name;
+  name << "match/" << nreferences;
+  return name.str();
+}
+
+// match a warped copy of the first reference against nreferences references at once
+static PerfCase matchingCase(const std::vector< cv::Ptr< const aif::ResultMatcher > > &all_matchers,
+                             const aif::Results &source, const int nreferences,
+                             const int repeats) {
+  const std::vector< cv::Ptr< const aif::ResultMatcher > > matchers(
+      all_matchers.begin(), all_matchers.begin() + nreferences);
+
+  std::vector< double > walls, cpus;
+  std::size_t nmatches(0);
+  for (int i = 0; i < repeats + 1; ++i) {
+    std::vector< cv::Matx33f > transforms;
+    std::vector< std::vector< cv::DMatch > > matches_array;
+    const double cpu_start(cpuSeconds());
+    const int64 tick(cv::getTickCount());
+    aif::ResultMatcher::parallelMatch(matchers, source, transforms, matches_array);
+    // the first run is a warm-up
+    if (i == 0) {
+      continue;
+    }
+    walls.push_back((cv::getTickCount() - tick) / cv::getTickFrequency());
+    cpus.push_back(cpuSeconds() - cpu_start);
+    nmatches = 0;
+    for (std::size_t j = 0; j < matches_array.size(); ++j) {
+      nmatches += matches_array[j].size();
+    }
+  }
+
+  PerfCase perf;
+  perf.name = matchingCaseName(nreferences);
+  perf.wallSeconds = median(walls);
+  perf.cpuSeconds = median(cpus);
+  perf.processPeakRssKB = processPeakRssKB();
+  perf.rateName = "matchesPerSecond";
+  perf.rate = perf.wallSeconds > 0. ? nmatches / perf.wallSeconds : 0.;
+  return perf;
+}
+
+static PerfCase failedCase(const std::string &name, const std::string &rate_name,
+                           const std::string &error) {
+  PerfCase perf;
+  perf.name = name;
+  perf.rateName = rate_name;
+  perf.failed = true;
+  perf.error = error;
+  return perf;
+}
+
+// run a case, and record an exception from it as a failure of the case
+template < typename Function >
+static PerfCase runCase(const std::string &name, const std::string &rate_name,
+                        const Function &function) {
+  try {
+    return function();
+  } catch (const std::exception &error) {
+    return failedCase(name, rate_name, error.what());
+  }
+}
+
+// print the result of a case
+static void report(const PerfCase &perf) {
+  if (perf.failed) {
+    std::cout << perf.name << ": FAILED (" << perf.error << ")" << std::endl;
+  } else {
+    std::cout << perf.name << ": " << perf.wallSeconds << " s" << std::endl;
+  }
+}
+
+//
+// JSON input and output
+//
+
+// JSON string literal with escapes of quotes, backslashes and control characters
+static std::string jsonString(const std::string &str) {
+  std::ostringstream oss;
+  oss << '"';
+  for (std::string::const_iterator c = str.begin(); c != str.end(); ++c) {
+    if (*c == '"' || *c == '\\') {
+      oss << '\\' << *c;
+    } else if (static_cast< unsigned char >(*c) < 0x20) {
+      oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast< int >(*c)
+          << std::dec << std::setfill(' ');
+    } else {
+      oss << *c;
+    }
+  }
+  oss << '"';
+  return oss.str();
+}
+
+static void writeJson(std::ostream &os, const std::vector< PerfCase > &cases) {
+  os << std::setprecision(6);
+  os << "{\n"
+     << "  \"opencv\": \"" << CV_VERSION << "\",\n"
+     << "  \"threads\": " << cv::getNumThreads() << ",\n"
+     << "  \"cases\": [\n";
+  for (std::size_t i = 0; i < cases.size(); ++i) {
+    const PerfCase &perf(cases[i]);
+    os << "    { \"name\": " << jsonString(perf.name);
+    if (perf.failed) {
+      os << ", \"failed\": true, \"error\": " << jsonString(perf.error);
+    } else {
+      os << ", \"wallSeconds\": " << perf.wallSeconds << ", \"cpuSeconds\": " << perf.cpuSeconds
+         << ", \"processPeakRssKB\": " << perf.processPeakRssKB << ", \"" << perf.rateName
+         << "\": " << perf.rate;
+    }
+    os << " }" << (i + 1 < cases.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n"
+     << "}\n";
+}
+
+// wall seconds of cases in a JSON file written by writeJson() (failed cases are skipped)
+static std::map< std::string, double > readBaseline(const std::string &path) {
+  namespace bp = boost::property_tree;
+  bp::ptree root;
+  bp::read_json(path, root);
+  std::map< std::string, double > wall_seconds;
+  BOOST_FOREACH (const bp::ptree::value_type &perf, root.get_child("cases")) {
+    if (perf.second.get< bool >("failed", false)) {
+      continue;
+    }
+    wall_seconds[perf.second.get< std::string >("name")] =
+        perf.second.get< double >("wallSeconds");
+  }
+  return wall_seconds;
+}
+
+int main(int argc, char *argv[]) {
+  const cv::CommandLineParser args(
+      argc, argv,
+      "{ help | | }"
+      "{ repeats | 3 | number of runs per case (the median is reported) }"
+      "{ image-size | 640 | width and height of synthetic images }"
+      "{ matcher-sizes | 1,16,256 | comma-separated numbers of references matched at once }"
+      "{ baseline | | optional result file of a previous run to be compared }"
+      "{ tolerance | 0.2 | allowed ratio of slowdown in wall time from the baseline }"
+      "{ @result-file | <none> | output JSON file }");
+
+  if (args.has("help")) {
+    args.printMessage();
+    return 0;
+  }
+
+  const int repeats(args.get< int >("repeats"));
+  const int image_size(args.get< int >("image-size"));
+  const std::string matcher_sizes_str(args.get< std::string >("matcher-sizes"));
+  const std::string baseline_path(args.get< std::string >("baseline"));
+  const double tolerance(args.get< double >("tolerance"));
+  const std::string result_path(args.get< std::string >("@result-file"));
+  if (!args.check()) {
+    args.printErrors();
+    return 1;
+  }
+  AIF_Assert(repeats > 0 && image_size > 0, "Invalid repeats or image size");
+
+  std::vector< int > matcher_sizes;
+  {
+    std::istringstream iss(matcher_sizes_str);
+    std::string size;
+    while (std::getline(iss, size, ',')) {
+      matcher_sizes.push_back(std::atoi(size.c_str()));
+      AIF_Assert(matcher_sizes.back() > 0, "Invalid matcher size %s", size.c_str());
+    }
+  }
+
+  std::vector< PerfCase > cases;
+
+  // extraction by every registered feature type
+  const cv::Mat image(syntheticImage(0, image_size));
+  const std::vector< cv::Ptr< aif::FeatureParameters > > params_array(allFeatureParameters());
+  for (std::size_t i = 0; i < params_array.size(); ++i) {
+    const aif::FeatureParameters &params(*params_array[i]);
+    cases.push_back(runCase(extractionCaseName(params), "keypointsPerSecond",
+                            boost::bind(&extractionCase, boost::cref(params),
+                                        boost::cref(image), repeats)));
+    report(cases.back());
+  }
+
+  // matching against references of various sizes
+  if (!matcher_sizes.empty()) {
+    const int max_size(*std::max_element(matcher_sizes.begin(), matcher_sizes.end()));
+    std::vector< cv::Ptr< const aif::ResultMatcher > > matchers;
+    cv::Ptr< const aif::Results > source;
+    std::string setup_error;
+    try {
+      const cv::Ptr< cv::Feature2D > feature(aif::ORBParameters().createFeature());
+      for (int i = 0; i < max_size; ++i) {
+        matchers.push_back(
+            new aif::ResultMatcher(extract(*feature, syntheticImage(i, image_size))));
+      }
+      // the source is the first reference seen from another viewpoint
+      const cv::Matx33f warp(0.9f, 0.1f, 20.f, -0.1f, 0.9f, 40.f, 1e-4f, 0.f, 1.f);
+      cv::Mat source_image;
+      cv::warpPerspective(syntheticImage(0, image_size), source_image, warp, image.size());
+      source = extract(*feature, source_image);
+    } catch (const std::exception &error) {
+      setup_error = error.what();
+    }
+    for (std::size_t i = 0; i < matcher_sizes.size(); ++i) {
+      const std::string name(matchingCaseName(matcher_sizes[i]));
+      if (setup_error.empty()) {
+        cases.push_back(runCase(name, "matchesPerSecond",
+                                boost::bind(&matchingCase, boost::cref(matchers),
+                                            boost::cref(*source), matcher_sizes[i], repeats)));
+      } else {
+        cases.push_back(failedCase(name, "matchesPerSecond", setup_error));
+      }
+      report(cases.back());
+    }
+  }
+
+  std::ofstream result_file(result_path.c_str());
+  AIF_Assert(result_file, "Could not open or create %s", result_path.c_str());
+  writeJson(result_file, cases);
+  std::cout << "Wrote results to " << result_path << std::endl;
+
+  // failed cases fail the run even without the baseline
+  int nfailures(0);
+  for (std::vector< PerfCase >::const_iterator perf = cases.begin(); perf != cases.end(); ++perf) {
+    if (perf->failed) {
+      ++nfailures;
+    }
+  }
+  std::cout << nfailures << " failed cases" << std::endl;
+
+  // compare wall times with the baseline
+  if (baseline_path.empty()) {
+    return nfailures > 0 ? 1 : 0;
+  }
+  const std::map< std::string, double > baseline(readBaseline(baseline_path));
+  int nregressions(0);
+  std::cout << "Comparison with " << baseline_path << ":" << std::endl;
+  for (std::vector< PerfCase >::const_iterator perf = cases.begin(); perf != cases.end(); ++perf) {
+    if (perf->failed) {
+      std::cout << "  " << perf->name << ": FAILED" << std::endl;
+      continue;
+    }
+    const std::map< std::string, double >::const_iterator base(baseline.find(perf->name));
+    if (base == baseline.end() || base->second <= 0.) {
+      std::cout << "  " << perf->name << ": not in the baseline" << std::endl;
+      continue;
+    }
+    const double ratio(perf->wallSeconds / base->second);
+    const bool regressed(ratio > 1. + tolerance);
+    std::cout << "  " << perf->name << ": " << ratio << "x" << (regressed ? " REGRESSED" : "")
+              << std::endl;
+    if (regressed) {
+      ++nregressions;
+    }
+  }
+  std::cout << nregressions << " regressions" << std::endl;
+  return nregressions > 0 || nfailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <affine_invariant_features/content_hash.hpp>
+#include <affine_invariant_features/feature_cache.hpp>
+#include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/results.hpp>
+#include <affine_invariant_features/target.hpp>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include "aif_assert.hpp"
+
+int main(int argc, char *argv[]) {
+  namespace aif = affine_invariant_features;
+
+  const cv::CommandLineParser args(
+      argc, argv,
+      "{ help | | }"
+      "{ quantize | | store float descriptors as 8-bit integers to save memory }"
+      "{ cache-dir | | optional directory to cache extracted features }"
+      "{ cache-size | 0 | maximum size of the cache in MB (0 for unlimited) }"
+      "{ @parameter-file | <none> | can be generated by generate_parameter_file }"
+      "{ @manifest | <none> | each line has a target file and a result file to be written }");
+
+  if (args.has("help")) {
+    args.printMessage();
+    return 0;
+  }
+
+  const std::string param_path(args.get< std::string >("@parameter-file"));
+  const std::string manifest_path(args.get< std::string >("@manifest"));
+  const bool quantize(args.has("quantize"));
+  const std::string cache_dir(args.get< std::string >("cache-dir"));
+  const int cache_size(args.get< int >("cache-size"));
+  if (!args.check()) {
+    args.printErrors();
+    return 1;
+  }
+
+  const cv::FileStorage param_file(param_path, cv::FileStorage::READ);
+  AIF_Assert(param_file.isOpened(), "Could not open %s", param_path.c_str());
+
+  const cv::Ptr< const aif::FeatureParameters > params(
+      aif::load< aif::FeatureParameters >(param_file.root()));
+  AIF_Assert(params, "Could not load a parameter set from %s", param_path.c_str());
+  AIF_Assert(params->isDetector() && params->isExtractor(),
+             "%s cannot both detect keypoints and compute descriptors. Detector-only or "
+             "extractor-only types are valid only as the 1st or 2nd entry of AIFParameters",
+             param_path.c_str());
+
+  // the feature is shared by all targets
+  const cv::Ptr< cv::Feature2D > feature(params->createFeature());
+  AIF_Assert(feature, "Could not create a feature algorithm from %s", param_path.c_str());
+
+  std::vector< std::pair< std::string, std::string > > jobs;
+  {
+    std::ifstream manifest(manifest_path.c_str());
+    AIF_Assert(manifest, "Could not open %s", manifest_path.c_str());
+    std::string line;
+    while (std::getline(manifest, line)) {
+      std::istringstream iss(line);
+      std::string target_path, result_path;
+      if (line.empty() || line[0] == '#' || !(iss >> target_path >> result_path)) {
+        continue;
+      }
+      jobs.push_back(std::make_pair(target_path, result_path));
+    }
+  }
+  std::cout << "Extracting features of " << jobs.size() << " targets listed in " << manifest_path
+            << std::endl;
+
+  cv::Ptr< aif::FeatureCache > cache;
+  if (!cache_dir.empty()) {
+    // also keep hashes of target images there so that following runs do not rehash them
+    aif::ContentHash::setCacheDirectory(cache_dir);
+    cache = new aif::FeatureCache(cache_dir, static_cast< boost::uintmax_t >(cache_size) << 20);
+  }
+
+  std::size_t nsucceeded(0), ncached(0), nkeypoints(0);
+  const int64 start_tick(cv::getTickCount());
+  for (std::size_t i = 0; i < jobs.size(); ++i) {
+    const std::string &target_path(jobs[i].first);
+    const std::string &result_path(jobs[i].second);
+    try {
+      const cv::FileStorage target_file(target_path, cv::FileStorage::READ);
+      AIF_Assert(target_file.isOpened(), "Could not open %s", target_path.c_str());
+
+      const cv::Ptr< const aif::TargetDescription > target_desc(
+          aif::load< aif::TargetDescription >(target_file.root()));
+      AIF_Assert(target_desc, "Could not load an target description from %s",
+                 target_path.c_str());
+
+      const std::string cache_key(cache ? aif::FeatureCache::generateKey(*params, *target_desc)
+                                        : std::string());
+      const cv::Ptr< aif::Results > cached_results(cache ? cache->load(cache_key)
+                                                         : cv::Ptr< aif::Results >());
+
+      aif::Results results;
+      if (cached_results) {
+        results = *cached_results;
+        ++ncached;
+      } else {
+        const cv::Ptr< const aif::TargetData > target_data(
+            aif::TargetData::retrieve(*target_desc));
+        AIF_Assert(target_data, "Could not load target data described in %s",
+                   target_path.c_str());
+
+        feature->detectAndCompute(target_data->image, target_data->mask, results.keypoints,
+                                  results.descriptors);
+        results.normType = feature->defaultNorm();
+        if (cache) {
+          cache->save(cache_key, results);
+        }
+      }
+      if (quantize) {
+        results.quantizeDescriptors();
+      }
+
+      cv::FileStorage result_file(result_path, cv::FileStorage::WRITE);
+      AIF_Assert(result_file.isOpened(), "Could not open or create %s", result_path.c_str());
+
+      params->save(result_file);
+      target_desc->save(result_file);
+      results.save(result_file);
+
+      ++nsucceeded;
+      nkeypoints += results.keypoints.size();
+      std::cout << "[" << i + 1 << "/" << jobs.size() << "] Wrote " << results.keypoints.size()
+                << " features to " << result_path << std::endl;
+    } catch (const std::exception &error) {
+      std::cerr << "[" << i + 1 << "/" << jobs.size() << "] " << error.what() << std::endl;
+    }
+  }
+  const double seconds((cv::getTickCount() - start_tick) / cv::getTickFrequency());
+
+  std::cout << "Statistics:" << std::endl
+            << "  targets: " << nsucceeded << " succeeded (" << ncached << " cached), "
+            << jobs.size() - nsucceeded << " failed" << std::endl
+            << "  keypoints: " << nkeypoints << std::endl
+            << "  elapsed: " << seconds << " s" << std::endl
+            << "  throughput: " << nsucceeded / seconds << " targets/s, " << nkeypoints / seconds
+            << " keypoints/s" << std::endl;
+
+  return nsucceeded == jobs.size() ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <affine_invariant_features/content_hash.hpp>
+#include <affine_invariant_features/matcher_parameters.hpp>
+#include <affine_invariant_features/reference_loader.hpp>
+#include <affine_invariant_features/result_matcher.hpp>
+#include <affine_invariant_features/sharded_matcher.hpp>
+#include <affine_invariant_features/vocabulary_tree.hpp>
+
+#include <opencv2/core.hpp>
+
+#include "aif_assert.hpp"
+
+int main(int argc, char *argv[]) {
+  namespace aif = affine_invariant_features;
+
+  const cv::CommandLineParser args(
+      argc, argv,
+      "{ help | | }"
+      "{ matcher-file | | optional, can be generated by generate_parameter_file }"
+      "{ min-match-ratio | 0 | minimum ratio of matches to keypoints of a reference }"
+      "{ shards | 0 | number of worker processes holding references (0 for in-process) }"
+      "{ shortlist | 0 | number of references verified per source (0 for all) }"
+      "{ index-file | | vocabulary and inverted file for shortlisting, built if not exist }"
+      "{ @source-list | <none> | directory or manifest of feature files to be matched }"
+      "{ @reference-list | <none> | directory or manifest of reference feature files }"
+      "{ @result-file | <none> | output file of the match matrix }");
+
+  if (args.has("help")) {
+    args.printMessage();
+    return 0;
+  }
+
+  const std::string matcher_path(args.get< std::string >("matcher-file"));
+  const double min_match_ratio(args.get< double >("min-match-ratio"));
+  const int nshards(args.get< int >("shards"));
+  const int shortlist(args.get< int >("shortlist"));
+  const std::string index_path(args.get< std::string >("index-file"));
+  const std::string source_list(args.get< std::string >("@source-list"));
+  const std::string reference_list(args.get< std::string >("@reference-list"));
+  const std::string result_path(args.get< std::string >("@result-file"));
+  if (!args.check()) {
+    args.printErrors();
+    return 1;
+  }
+  AIF_Assert(shortlist <= 0 || nshards <= 0, "Shortlisting is not supported with shards");
+
+  cv::Ptr< aif::MatcherParameters > matcher_params;
+  if (!matcher_path.empty()) {
+    const cv::FileStorage matcher_file(matcher_path, cv::FileStorage::READ);
+    AIF_Assert(matcher_file.isOpened(), "Could not open %s", matcher_path.c_str());
+    matcher_params = aif::load< aif::MatcherParameters >(matcher_file.root());
+    AIF_Assert(matcher_params, "Could not load a matcher parameter set from %s",
+               matcher_path.c_str());
+  }
+
+  // fork workers for sharded references first because forked processes do not inherit threads
+  const int64 load_tick(cv::getTickCount());
+  const std::vector< std::string > reference_paths(aif::ReferenceSet::listFiles(reference_list));
+  aif::ShardedMatcher sharded_matcher;
+  if (nshards > 0) {
+    sharded_matcher.start(reference_paths, nshards, matcher_params);
+  }
+
+  // load sources and references (and build matchers for references) in parallel
+  aif::ReferenceSet sources;
+  sources.load(aif::ReferenceSet::listFiles(source_list), cv::Ptr< const aif::MatcherParameters >(),
+               -1., false);
+  // sharded references are loaded only by the workers
+  aif::ReferenceSet references;
+  if (nshards <= 0) {
+    references.load(reference_paths, matcher_params);
+  }
+  const double load_seconds((cv::getTickCount() - load_tick) / cv::getTickFrequency());
+  std::cout << "Loaded " << sources.size() << " sources and " << reference_paths.size()
+            << " references in " << load_seconds << " s" << std::endl;
+  if (nshards > 0) {
+    std::cout << "References are sharded over " << sharded_matcher.numShards()
+              << " worker processes" << std::endl;
+  }
+
+  // load or build the index to shortlist references.
+  // references are identified by content hashes of their files (or paths if not readable),
+  // and the index is rebuilt if it was built for other references.
+  aif::InvertedIndex index;
+  if (shortlist > 0) {
+    const int64 index_tick(cv::getTickCount());
+    std::vector< std::string > reference_ids(reference_paths.size());
+    for (std::size_t i = 0; i < reference_paths.size(); ++i) {
+      reference_ids[i] = aif::ContentHash::generate(reference_paths[i], "xxh64");
+      if (reference_ids[i].empty()) {
+        reference_ids[i] = reference_paths[i];
+      }
+    }
+    const cv::FileStorage index_file(index_path, cv::FileStorage::READ);
+    if (index_file.isOpened()) {
+      index.read(index_file[index.getDefaultName()]);
+    }
+    if (!index.empty() && index.getReferenceIds() == reference_ids) {
+      std::cout << "Loaded";
+    } else {
+      if (index_file.isOpened()) {
+        std::cout << index_path << " does not index the references. Rebuilding it." << std::endl;
+      }
+      index.build(references.getResults());
+      index.setReferenceIds(reference_ids);
+      if (!index_path.empty()) {
+        cv::FileStorage output_file(index_path, cv::FileStorage::WRITE);
+        AIF_Assert(output_file.isOpened(), "Could not open or create %s", index_path.c_str());
+        index.save(output_file);
+      }
+      std::cout << "Built";
+    }
+    std::cout << " an index of " << index.getVocabulary().numWords() << " words in "
+              << (cv::getTickCount() - index_tick) / cv::getTickFrequency() << " s" << std::endl;
+  }
+
+  // match each source against all (or shortlisted) references
+  const std::vector< cv::Ptr< const aif::ResultMatcher > > matchers(references.getMatchers());
+  const std::vector< double > min_match_ratios(reference_paths.size(), min_match_ratio);
+  cv::Mat match_counts(sources.size(), reference_paths.size(), CV_32SC1, cv::Scalar::all(0));
+  std::size_t ndescriptors(0);
+  const int64 match_tick(cv::getTickCount());
+  for (std::size_t i = 0; i < sources.size(); ++i) {
+    if (!sources[i].results) {
+      continue;
+    }
+    std::vector< cv::Matx33f > transforms;
+    std::vector< std::vector< cv::DMatch > > matches_array;
+    if (nshards > 0) {
+      sharded_matcher.parallelMatch(*sources[i].results, transforms, matches_array,
+                                    min_match_ratios);
+    } else if (shortlist > 0) {
+      index.parallelMatch(matchers, *sources[i].results, shortlist, transforms, matches_array,
+                          min_match_ratios);
+    } else {
+      aif::ResultMatcher::parallelMatch(matchers, *sources[i].results, transforms, matches_array,
+                                        min_match_ratios);
+    }
+    for (std::size_t j = 0; j < matches_array.size(); ++j) {
+      match_counts.at< int >(i, j) = matches_array[j].size();
+    }
+    ndescriptors += sources[i].results->descriptors.rows;
+  }
+  const double match_seconds((cv::getTickCount() - match_tick) / cv::getTickFrequency());
+
+  cv::FileStorage result_file(result_path, cv::FileStorage::WRITE);
+  AIF_Assert(result_file.isOpened(), "Could not open or create %s", result_path.c_str());
+
+  // the matcher parameters which gave the counts (or the defaults if no file is given)
+  if (matcher_params) {
+    matcher_params->save(result_file);
+  } else {
+    aif::ResultMatcherParameters().save(result_file);
+  }
+  result_file << "sources"
+              << "[";
+  for (std::size_t i = 0; i < sources.size(); ++i) {
+    result_file << sources[i].path;
+  }
+  result_file << "]";
+  result_file << "references"
+              << "[";
+  for (std::size_t j = 0; j < reference_paths.size(); ++j) {
+    result_file << reference_paths[j];
+  }
+  result_file << "]";
+  result_file << "matchCounts" << match_counts;
+  std::cout << "Wrote the match matrix to " << result_path << std::endl;
+
+  const std::size_t npairs(sources.size() * reference_paths.size());
+  std::cout << "Statistics:" << std::endl
+            << "  pairs: " << npairs << std::endl
+            << "  elapsed: " << load_seconds << " s (loading), " << match_seconds
+            << " s (matching)" << std::endl
+            << "  throughput: " << npairs / match_seconds << " pairs/s, "
+            << ndescriptors / match_seconds << " source descriptors/s" << std::endl;
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include <string>
 
 #include <affine_invariant_features/affine_invariant_feature.hpp>
+#include <affine_invariant_features/content_hash.hpp>
+#include <affine_invariant_features/feature_cache.hpp>
 #include <affine_invariant_features/feature_parameters.hpp>
 #include <affine_invariant_features/results.hpp>
 #include <affine_invariant_features/target.hpp>
@@ -17,6 +19,11 @@ int main(int argc, char *argv[]) {
 
   const cv::CommandLineParser args(
       argc, argv, "{ help | | }"
+                  "{ headless | | do not show images }"
+                  "{ quantize | | store float descriptors as 8-bit integers to save memory }"
+                  "{ cache-dir | | optional directory to cache extracted features }"
+                  "{ cache-size | 0 | maximum size of the cache in MB (0 for unlimited) }"
+                  "{ memory-budget | 0 | limit of memory for simulations in MB (0 for unlimited) }"
                   "{ @parameter-file | <none> | can be generated by generate_parameter_file }"
                   "{ @target-file | <none> | can be generated by generate_target_file }"
                   "{ @result-file | <none> | }");
@@ -29,6 +36,11 @@ int main(int argc, char *argv[]) {
   const std::string param_path(args.get< std::string >("@parameter-file"));
   const std::string target_path(args.get< std::string >("@target-file"));
   const std::string result_path(args.get< std::string >("@result-file"));
+  const bool headless(args.has("headless"));
+  const bool quantize(args.has("quantize"));
+  const std::string cache_dir(args.get< std::string >("cache-dir"));
+  const int cache_size(args.get< int >("cache-size"));
+  const int memory_budget(args.get< int >("memory-budget"));
   if (!args.check()) {
     args.printErrors();
     return 1;
@@ -40,10 +52,20 @@ int main(int argc, char *argv[]) {
   const cv::Ptr< const aif::FeatureParameters > params(
       aif::load< aif::FeatureParameters >(param_file.root()));
   AIF_Assert(params, "Could not load a parameter set from %s", param_path.c_str());
+  AIF_Assert(params->isDetector() && params->isExtractor(),
+             "%s cannot both detect keypoints and compute descriptors. Detector-only or "
+             "extractor-only types are valid only as the 1st or 2nd entry of AIFParameters",
+             param_path.c_str());
 
   const cv::Ptr< cv::Feature2D > feature(params->createFeature());
   AIF_Assert(feature, "Could not create a feature algorithm from %s", param_path.c_str());
 
+  const cv::Ptr< aif::AffineInvariantFeature > affine_feature(
+      feature.dynamicCast< aif::AffineInvariantFeature >());
+  if (affine_feature) {
+    affine_feature->setMemoryBudget(static_cast< std::size_t >(memory_budget) << 20);
+  }
+
   const cv::FileStorage target_file(target_path, cv::FileStorage::READ);
   AIF_Assert(target_file.isOpened(), "Could not open %s", target_path.c_str());
 
@@ -56,21 +78,51 @@ int main(int argc, char *argv[]) {
 
   cv::Mat target_image(target_data->image / 4);
   target_data->image.copyTo(target_image, target_data->mask);
-  std::cout << "Showing the target image with mask. Press any key to continue." << std::endl;
-  cv::imshow("Target", target_image);
-  cv::waitKey(0);
+  if (!headless) {
+    std::cout << "Showing the target image with mask. Press any key to continue." << std::endl;
+    cv::imshow("Target", target_image);
+    cv::waitKey(0);
+  }
+
+  cv::Ptr< aif::FeatureCache > cache;
+  std::string cache_key;
+  cv::Ptr< aif::Results > cached_results;
+  if (!cache_dir.empty()) {
+    // also keep hashes of target images there so that following runs do not rehash them
+    aif::ContentHash::setCacheDirectory(cache_dir);
+    cache = new aif::FeatureCache(cache_dir, static_cast< boost::uintmax_t >(cache_size) << 20);
+    cache_key = aif::FeatureCache::generateKey(*params, *target_desc);
+    cached_results = cache->load(cache_key);
+  }
 
-  std::cout << "Extracting features. This may take seconds or minutes." << std::endl;
   aif::Results results;
-  feature->detectAndCompute(target_data->image, target_data->mask, results.keypoints,
-                            results.descriptors);
-  results.normType = feature->defaultNorm();
-
-  cv::Mat result_image;
-  cv::drawKeypoints(target_image, results.keypoints, result_image);
-  std::cout << "Showing a result image with keypoints. Press any key to continue." << std::endl;
-  cv::imshow("Results", result_image);
-  cv::waitKey(0);
+  if (cached_results) {
+    std::cout << "Found cached features in " << cache_dir << std::endl;
+    results = *cached_results;
+  } else {
+    std::cout << "Extracting features. This may take seconds or minutes." << std::endl;
+    feature->detectAndCompute(target_data->image, target_data->mask, results.keypoints,
+                              results.descriptors);
+    results.normType = feature->defaultNorm();
+    if (affine_feature) {
+      std::cout << "Estimated peak memory usage of extraction: "
+                << (affine_feature->getPeakMemoryUsage() >> 20) << " MB" << std::endl;
+    }
+    if (cache) {
+      cache->save(cache_key, results);
+    }
+  }
+  if (quantize) {
+    results.quantizeDescriptors();
+  }
+
+  if (!headless) {
+    cv::Mat result_image;
+    cv::drawKeypoints(target_image, results.keypoints, result_image);
+    std::cout << "Showing a result image with keypoints. Press any key to continue." << std::endl;
+    cv::imshow("Results", result_image);
+    cv::waitKey(0);
+  }
 
   cv::FileStorage result_file(result_path, cv::FileStorage::WRITE);
   AIF_Assert(result_file.isOpened(), "Could not open or create %s", result_path.c_str());
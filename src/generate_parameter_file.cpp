@@ -3,6 +3,7 @@
 #include <vector>
 
 #include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/matcher_parameters.hpp>
 
 #include <opencv2/core.hpp>
 
@@ -16,6 +17,7 @@ int main(int argc, char *argv[]) {
       argc, argv,
       "{ help | | }"
       "{ non-aif | | generate non affine invariant feature parameters }"
+      "{ matcher | | generate matcher parameters instead of feature parameters }"
       "{ list | | list available type names of parameter sets }"
       "{ @type | <none> | type of first parameter set }"
       "{ @file | <none> | output file }"
@@ -27,7 +29,8 @@ int main(int argc, char *argv[]) {
   }
 
   if (args.has("list")) {
-    const std::vector< std::string > names(aif::getFeatureParameterNames());
+    const std::vector< std::string > names(args.has("matcher") ? aif::getMatcherParameterNames()
+                                                                : aif::getFeatureParameterNames());
     for (std::vector< std::string >::const_iterator name = names.begin(); name != names.end();
          ++name) {
       std::cout << *name << std::endl;
@@ -39,11 +42,29 @@ int main(int argc, char *argv[]) {
   const std::string type2(args.get< std::string >("@type2"));
   const std::string path(args.get< std::string >("@file"));
   const bool non_aif(args.has("non-aif"));
+  const bool matcher(args.has("matcher"));
   if (!args.check()) {
     args.printErrors();
     return 1;
   }
 
+  if (matcher) {
+    aif::ResultMatcherParameters params;
+    if (type != params.getDefaultName()) {
+      params.matcher = aif::createMatcherParameters(type);
+      AIF_Assert(params.matcher, "Could not create a matcher parameter set whose type is %s",
+                 type.c_str());
+    }
+
+    cv::FileStorage file(path, cv::FileStorage::WRITE);
+    AIF_Assert(file.isOpened(), "Could not open or create %s", path.c_str());
+
+    params.save(file);
+    std::cout << "Wrote a parameter set whose type is " << params.getDefaultName() << " to " << path
+              << std::endl;
+    return 0;
+  }
+
   aif::AIFParameters params;
 
   params.push_back(aif::createFeatureParameters(type));
@@ -56,6 +77,13 @@ int main(int argc, char *argv[]) {
                type2.c_str());
   }
 
+  // the extraction tools need both keypoints and descriptors
+  const aif::FeatureParameters &checked(non_aif ? *params[0] : params);
+  AIF_Assert(checked.isDetector() && checked.isExtractor(),
+             "%s cannot both detect keypoints and compute descriptors. Detector-only or "
+             "extractor-only types are valid only as the 1st or 2nd type of AIFParameters",
+             checked.getDefaultName().c_str());
+
   cv::FileStorage file(path, cv::FileStorage::WRITE);
   AIF_Assert(file.isOpened(), "Could not open or create %s", path.c_str());
 
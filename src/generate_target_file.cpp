@@ -13,6 +13,7 @@ int main(int argc, char *argv[]) {
 
   const cv::CommandLineParser args(
       argc, argv, "{ help | | }"
+                  "{ hash | md5 | type of hash of the image (md5 or xxh64) }"
                   "{ @image | <none> | absolute, or relative to the current path or <package> }"
                   "{ @file | <none> | output file describing the image }"
                   "{ @package | | optional name of a ROS package where the image locates }");
@@ -25,6 +26,7 @@ int main(int argc, char *argv[]) {
   const std::string image_path(args.get< std::string >("@image"));
   const std::string file_path(args.get< std::string >("@file"));
   const std::string package_name(args.get< std::string >("@package"));
+  const std::string hash_type(args.get< std::string >("hash"));
   if (!args.check()) {
     args.printErrors();
     return 1;
@@ -37,7 +39,10 @@ int main(int argc, char *argv[]) {
   aif::TargetDescription target;
   target.package = package_name;
   target.path = image_path;
-  target.md5 = aif::TargetDescription::generateMD5(resolved_path);
+  target.hashType = hash_type;
+  target.hash = aif::TargetDescription::generateHash(resolved_path, hash_type);
+  AIF_Assert(!target.hash.empty(), "Could not generate a %s hash of %s", hash_type.c_str(),
+             resolved_path.c_str());
   target.contour.push_back(cv::Point(0, 0));
   target.contour.push_back(cv::Point(image.cols - 1, 0));
   target.contour.push_back(cv::Point(image.cols - 1, image.rows - 1));
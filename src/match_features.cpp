@@ -2,6 +2,7 @@
 #include <string>
 
 #include <affine_invariant_features/feature_parameters.hpp>
+#include <affine_invariant_features/matcher_parameters.hpp>
 #include <affine_invariant_features/target.hpp>
 #include <affine_invariant_features/results.hpp>
 #include <affine_invariant_features/result_matcher.hpp>
@@ -35,6 +36,8 @@ int main(int argc, char *argv[]) {
 
   const cv::CommandLineParser args(
       argc, argv, "{ help | | }"
+                  "{ headless | | do not show images }"
+                  "{ matcher-file | | optional, can be generated by generate_parameter_file }"
                   "{ @feature-file1 | <none> | can be generated by extract_features }"
                   "{ @feature-file2 | <none> | can be generated by extract_features }"
                   "{ @image | | optional output image }");
@@ -47,11 +50,22 @@ int main(int argc, char *argv[]) {
   const std::string feature_path1(args.get< std::string >("@feature-file1"));
   const std::string feature_path2(args.get< std::string >("@feature-file2"));
   const std::string image_path(args.get< std::string >("@image"));
+  const std::string matcher_path(args.get< std::string >("matcher-file"));
+  const bool headless(args.has("headless"));
   if (!args.check()) {
     args.printErrors();
     return 1;
   }
 
+  cv::Ptr< aif::MatcherParameters > matcher_params;
+  if (!matcher_path.empty()) {
+    const cv::FileStorage matcher_file(matcher_path, cv::FileStorage::READ);
+    AIF_Assert(matcher_file.isOpened(), "Could not open %s", matcher_path.c_str());
+    matcher_params = aif::load< aif::MatcherParameters >(matcher_file.root());
+    AIF_Assert(matcher_params, "Could not load a matcher parameter set from %s",
+               matcher_path.c_str());
+  }
+
   cv::Ptr< aif::TargetData > target1;
   cv::Ptr< aif::Results > results1;
   loadAll(feature_path1, target1, results1);
@@ -64,21 +78,27 @@ int main(int argc, char *argv[]) {
   std::cout << "loaded " << results2->keypoints.size() << " feature points from " << feature_path2
             << std::endl;
 
-  aif::ResultMatcher matcher(results2);
+  aif::ResultMatcher matcher(results2, matcher_params);
   std::cout << "Matching feature points. This may take seconds." << std::endl;
   cv::Matx33f transform;
   std::vector< cv::DMatch > matches;
   matcher.match(*results1, transform, matches);
   std::cout << "found " << matches.size() << " matches" << std::endl;
 
+  if (headless && image_path.empty()) {
+    return 0;
+  }
+
   const cv::Mat image1(shade(target1->image, target1->mask));
   const cv::Mat image2(shade(target2->image, target2->mask));
   cv::Mat image;
   cv::drawMatches(image1, results1->keypoints, image2, results2->keypoints, matches, image);
 
-  std::cout << "Showing feature points and matches. Press any key to continue." << std::endl;
-  cv::imshow("Matches", image);
-  cv::waitKey(0);
+  if (!headless) {
+    std::cout << "Showing feature points and matches. Press any key to continue." << std::endl;
+    cv::imshow("Matches", image);
+    cv::waitKey(0);
+  }
 
   if (!image_path.empty()) {
     cv::imwrite(image_path, image);